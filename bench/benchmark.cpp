@@ -0,0 +1,580 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+// Micro-benchmarks for the tiler, rescaling, hashing and thumbnails.
+// Results are printed as JSON so that runs of two releases can be diffed:
+//
+//   testbench [--out results.json] [--work-dir dir] [--size px]
+//             [--min-time seconds] [--input file.tif] [--filter group]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "exceptions.h"
+#include "gdal_inc.h"
+#include "gdaltiler.h"
+#include "hash.h"
+#include "rescale.h"
+#include "synthetic_raster.h"
+#include "bench_json.h"
+#include "thumbs.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using ddb::jsonNumber;
+using ddb::jsonString;
+using Clock = std::chrono::steady_clock;
+
+struct Timing {
+    uint64_t iterations = 0;
+    double meanUs = 0.0;
+    double p50Us = 0.0;
+    double p99Us = 0.0;
+    double maxUs = 0.0;
+};
+
+struct Result {
+    std::string group;
+    std::string name;
+    std::vector<std::pair<std::string, std::string>> params;
+    Timing timing;
+    std::vector<std::pair<std::string, double>> metrics;
+};
+
+struct Options {
+    std::string out;
+    fs::path workDir = fs::temp_directory_path() / "ddb-bench";
+    int size = 2048;
+    double minTime = 0.5;
+    std::string input;
+    std::string filter;
+};
+
+// Calls fn once to warm up, then until minSeconds have elapsed
+// and at least minIterations calls were timed
+Timing measure(const std::function<void()>& fn, double minSeconds, size_t minIterations = 5) {
+    fn();
+
+    std::vector<double> samples;
+    const auto begin = Clock::now();
+    while (samples.size() < minIterations ||
+           std::chrono::duration<double>(Clock::now() - begin).count() < minSeconds) {
+        const auto start = Clock::now();
+        fn();
+        samples.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    Timing t;
+    t.iterations = samples.size();
+    for (double s : samples)
+        t.meanUs += s;
+    t.meanUs /= static_cast<double>(samples.size());
+    t.p50Us = samples[(samples.size() - 1) / 2];
+    t.p99Us = samples[static_cast<size_t>(0.99 * static_cast<double>(samples.size() - 1))];
+    t.maxUs = samples.back();
+    return t;
+}
+
+void writeJson(std::ostream& out, const Options& opts, const std::vector<Result>& results) {
+    const std::time_t now = std::time(nullptr);
+    char timestamp[32];
+    std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    out << "{\n";
+    out << "  \"timestamp\": " << jsonString(timestamp) << ",\n";
+    out << "  \"gdal\": " << jsonString(GDALVersionInfo("RELEASE_NAME")) << ",\n";
+    out << "  \"rescaleKernel\": " << jsonString(ddb::rescaleKernelName()) << ",\n";
+    out << "  \"threads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"rasterSize\": " << opts.size << ",\n";
+    out << "  \"results\": [";
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    {\"group\": " << jsonString(r.group) << ", \"name\": " << jsonString(r.name) << ",\n";
+
+        out << "     \"params\": {";
+        for (size_t j = 0; j < r.params.size(); j++)
+            out << (j == 0 ? "" : ", ") << jsonString(r.params[j].first) << ": " << jsonString(r.params[j].second);
+        out << "},\n";
+
+        out << "     \"iterations\": " << r.timing.iterations
+            << ", \"meanUs\": " << jsonNumber(r.timing.meanUs)
+            << ", \"p50Us\": " << jsonNumber(r.timing.p50Us)
+            << ", \"p99Us\": " << jsonNumber(r.timing.p99Us)
+            << ", \"maxUs\": " << jsonNumber(r.timing.maxUs) << ",\n";
+
+        out << "     \"metrics\": {";
+        for (size_t j = 0; j < r.metrics.size(); j++)
+            out << (j == 0 ? "" : ", ") << jsonString(r.metrics[j].first) << ": " << jsonNumber(r.metrics[j].second);
+        out << "}}";
+    }
+
+    out << "\n  ]\n}\n";
+}
+
+// Tiled EPSG:3857 GeoTIFF, generated once per work dir
+std::string createDataset(const fs::path& dir, const ddb::SyntheticRasterSpec& spec) {
+    const fs::path path = dir / (ddb::syntheticRasterName(spec) + ".tif");
+    if (!fs::exists(path))
+        ddb::writeSyntheticRaster(path.string(), spec);
+    return path.string();
+}
+
+// Up to count tiles of the deepest zoom that the tiler can render
+std::vector<ddb::TileCoord> sampleTiles(ddb::GDALTiler& t, size_t count) {
+    std::vector<ddb::TileCoord> tiles;
+    const int z = t.tMaxZ;
+    const auto b = t.getMinMaxCoordsForZ(z);
+    for (int y = b.min.y; y <= b.max.y && tiles.size() < count; y++) {
+        for (int x = b.min.x; x <= b.max.x && tiles.size() < count; x++) {
+            uint8_t* buf = nullptr;
+            try {
+                t.tile(z, x, y, &buf, nullptr);
+                tiles.push_back({ z, x, y });
+            } catch (const ddb::GDALException&) {
+            }
+            VSIFree(buf);
+        }
+    }
+    return tiles;
+}
+
+void benchTile(const std::string& path, const std::string& dataset, const Options& opts,
+               std::vector<Result>& results) {
+    for (int tileSize : { 256, 512 }) {
+        for (const char* output : { "memory", "directory" }) {
+            const fs::path outDir = opts.workDir / "tiles" / dataset / std::to_string(tileSize);
+            ddb::GDALTiler t(path, outDir.string(), tileSize, false);
+
+            // Measure rendering, not the reuse of tiles written by earlier iterations
+            t.setForceRender(true);
+
+            const std::vector<ddb::TileCoord> tiles = sampleTiles(t, 64);
+            if (tiles.empty())
+                continue;
+
+            t.enableMetrics();
+            size_t next = 0;
+            const bool toMemory = std::strcmp(output, "memory") == 0;
+
+            Result r;
+            r.group = "tile";
+            r.name = dataset + "/" + std::to_string(tileSize) + "/" + output;
+            r.params = { { "dataset", dataset }, { "tileSize", std::to_string(tileSize) },
+                         { "output", output }, { "zoom", std::to_string(tiles.front().z) } };
+            r.timing = measure([&]() {
+                const ddb::TileCoord& c = tiles[next++ % tiles.size()];
+                if (toMemory) {
+                    uint8_t* buf = nullptr;
+                    t.tile(c.z, c.x, c.y, &buf, nullptr);
+                    VSIFree(buf);
+                } else {
+                    t.tile(c.z, c.x, c.y);
+                }
+            }, opts.minTime);
+
+            const ddb::TileMetricsReport m = t.getMetrics();
+            r.metrics.push_back({ "tilesPerSecond", m.tilesPerSecond });
+            r.metrics.push_back({ "bytesReadPerTile", m.tiles ? static_cast<double>(m.bytesRead) / m.tiles : 0.0 });
+            r.metrics.push_back({ "bytesWrittenPerTile", m.tiles ? static_cast<double>(m.bytesWritten) / m.tiles : 0.0 });
+            for (const auto& s : m.stages) {
+                r.metrics.push_back({ s.name + "P50Us", s.p50Ms * 1000.0 });
+                r.metrics.push_back({ s.name + "P99Us", s.p99Ms * 1000.0 });
+            }
+            results.push_back(r);
+
+            // geoQuery is private to the tiler, its timings come from the
+            // stage histogram of the same run
+            if (toMemory) {
+                for (const auto& s : m.stages) {
+                    if (s.name != "geoQuery" || s.count == 0)
+                        continue;
+
+                    Result g;
+                    g.group = "geoQuery";
+                    g.name = dataset + "/" + std::to_string(tileSize);
+                    g.params = { { "dataset", dataset }, { "tileSize", std::to_string(tileSize) } };
+                    g.timing.iterations = s.count;
+                    g.timing.meanUs = s.meanMs * 1000.0;
+                    g.timing.p50Us = s.p50Ms * 1000.0;
+                    g.timing.p99Us = s.p99Ms * 1000.0;
+                    g.timing.maxUs = s.maxMs * 1000.0;
+                    results.push_back(g);
+                }
+            }
+        }
+    }
+}
+
+// Edge values of T: range ends, zero, and for floating point types NaN,
+// infinities and the neighbours of the rescale bounds
+template <typename T>
+std::vector<T> rescaleEdgeValues(double bMin, double bMax) {
+    std::vector<T> values = { std::numeric_limits<T>::lowest(), std::numeric_limits<T>::max(), T(0), T(1) };
+    for (double b : { bMin, bMax }) {
+        values.push_back(static_cast<T>(b));
+        if constexpr (std::is_floating_point<T>::value) {
+            values.push_back(std::nextafter(static_cast<T>(b), std::numeric_limits<T>::lowest()));
+            values.push_back(std::nextafter(static_cast<T>(b), std::numeric_limits<T>::max()));
+        } else {
+            if (static_cast<T>(b) > std::numeric_limits<T>::lowest())
+                values.push_back(static_cast<T>(static_cast<T>(b) - 1));
+            if (static_cast<T>(b) < std::numeric_limits<T>::max())
+                values.push_back(static_cast<T>(static_cast<T>(b) + 1));
+        }
+    }
+    if constexpr (std::is_floating_point<T>::value) {
+        values.push_back(std::numeric_limits<T>::quiet_NaN());
+        values.push_back(-std::numeric_limits<T>::quiet_NaN());
+        values.push_back(std::numeric_limits<T>::infinity());
+        values.push_back(-std::numeric_limits<T>::infinity());
+        values.push_back(std::numeric_limits<T>::denorm_min());
+        values.push_back(-T(0));
+    }
+    return values;
+}
+
+// Every kernel usable on this CPU must match rescaleScalar bit for bit.
+// Returns the number of mismatching (kernel, bounds, length) combinations.
+template <typename T>
+int checkRescaleType(const char* type, double lo, double hi) {
+    const std::vector<std::pair<double, double>> bounds = {
+        { lo + (hi - lo) * 0.1, hi - (hi - lo) * 0.1 },
+        { lo, hi },
+        { static_cast<double>(std::numeric_limits<T>::lowest()), static_cast<double>(std::numeric_limits<T>::max()) },
+        { 0.0, 1.0 },
+    };
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> dist(lo, hi);
+    std::uniform_int_distribution<size_t> pick(0, 1u << 30);
+
+    int failures = 0;
+    for (const auto& b : bounds) {
+        const std::vector<T> edges = rescaleEdgeValues<T>(b.first, b.second);
+
+        // Edge values scattered among random ones, at every lane offset
+        const size_t n = 4099;
+        std::vector<T> src(n);
+        for (size_t i = 0; i < n; i++)
+            src[i] = i % 3 == 0 ? edges[pick(rng) % edges.size()] : static_cast<T>(dist(rng));
+        for (size_t i = 0; i < edges.size() && i < n; i++)
+            src[i] = edges[i];
+
+        std::vector<uint8_t> reference(n), out(n);
+        ddb::rescaleScalar(src.data(), reference.data(), n, b.first, b.second);
+
+        for (const auto& k : ddb::rescaleKernels<T>()) {
+            // Short lengths cover the scalar tails of the vector loops
+            for (size_t len : { size_t(1), size_t(2), size_t(3), size_t(5), size_t(7), size_t(17), n }) {
+                std::fill(out.begin(), out.end(), 0xAB);
+                k.fn(src.data(), out.data(), len, b.first, b.second);
+                if (!std::equal(out.begin(), out.begin() + len, reference.begin())) {
+                    std::cerr << "Rescale mismatch: " << type << " kernel " << k.name << " bounds ["
+                              << b.first << ", " << b.second << "] length " << len << std::endl;
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+int checkRescale() {
+    int failures = 0;
+    failures += checkRescaleType<uint8_t>("Byte", 0, 255);
+    failures += checkRescaleType<uint16_t>("UInt16", 0, 65535);
+    failures += checkRescaleType<int16_t>("Int16", -32768, 32767);
+    failures += checkRescaleType<uint32_t>("UInt32", 0, 4294967295.0);
+    failures += checkRescaleType<int32_t>("Int32", -2147483648.0, 2147483647.0);
+    failures += checkRescaleType<float>("Float32", -1000.0, 9000.0);
+    failures += checkRescaleType<double>("Float64", -1000.0, 9000.0);
+    return failures;
+}
+
+template <typename T>
+void benchRescaleType(const char* type, T lo, T hi, const Options& opts, std::vector<Result>& results) {
+    const size_t n = 512 * 512 * 3;
+    std::vector<T> src(n);
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> dist(static_cast<double>(lo), static_cast<double>(hi));
+    for (auto& v : src)
+        v = static_cast<T>(dist(rng));
+
+    const double bMin = static_cast<double>(lo) + (static_cast<double>(hi) - static_cast<double>(lo)) * 0.1;
+    const double bMax = static_cast<double>(hi) - (static_cast<double>(hi) - static_cast<double>(lo)) * 0.1;
+
+    std::vector<uint8_t> fast(n), reference(n);
+    ddb::rescaleScalar(src.data(), reference.data(), n, bMin, bMax);
+
+    for (const char* kernel : { "dispatch", "scalar" }) {
+        const bool scalar = std::strcmp(kernel, "scalar") == 0;
+
+        Result r;
+        r.group = "rescale";
+        r.name = std::string(type) + "/" + kernel;
+        r.params = { { "type", type }, { "kernel", scalar ? "scalar" : ddb::rescaleKernelName() },
+                     { "samples", std::to_string(n) } };
+        r.timing = measure([&]() {
+            if (scalar)
+                ddb::rescaleScalar(src.data(), fast.data(), n, bMin, bMax);
+            else
+                ddb::rescaleBuffer(src.data(), fast.data(), n, bMin, bMax);
+        }, opts.minTime);
+
+        r.metrics.push_back({ "megabytesPerSecond", n * sizeof(T) / r.timing.meanUs });
+        r.metrics.push_back({ "identical", fast == reference ? 1.0 : 0.0 });
+        results.push_back(r);
+    }
+}
+
+void benchRescale(const Options& opts, std::vector<Result>& results) {
+    benchRescaleType<uint16_t>("UInt16", 0, 65535, opts, results);
+    benchRescaleType<int16_t>("Int16", -32768, 32767, opts, results);
+    benchRescaleType<int32_t>("Int32", -1000000, 1000000, opts, results);
+    benchRescaleType<float>("Float32", -1000.0f, 9000.0f, opts, results);
+    benchRescaleType<double>("Float64", -1000.0, 9000.0, opts, results);
+}
+
+void benchHash(const Options& opts, std::vector<Result>& results) {
+    std::mt19937 rng(7);
+    for (size_t size : { size_t(64) << 10, size_t(16) << 20 }) {
+        std::vector<char> data(size);
+        for (auto& c : data)
+            c = static_cast<char>(rng());
+
+        Result r;
+        r.group = "hash";
+        r.name = "strCRC64/" + std::to_string(size);
+        r.params = { { "function", "strCRC64" }, { "bytes", std::to_string(size) } };
+        r.timing = measure([&]() { Hash::strCRC64(data.data(), size); }, opts.minTime);
+        r.metrics.push_back({ "megabytesPerSecond", size / r.timing.meanUs });
+        results.push_back(r);
+
+        const fs::path file = opts.workDir / ("hash_" + std::to_string(size) + ".bin");
+        {
+            std::ofstream f(file, std::ios::binary);
+            f.write(data.data(), static_cast<std::streamsize>(size));
+        }
+
+        Result s;
+        s.group = "hash";
+        s.name = "fileSHA256/" + std::to_string(size);
+        s.params = { { "function", "fileSHA256" }, { "bytes", std::to_string(size) } };
+        s.timing = measure([&]() { Hash::fileSHA256(file.string()); }, opts.minTime);
+        s.metrics.push_back({ "megabytesPerSecond", size / s.timing.meanUs });
+        results.push_back(s);
+    }
+}
+
+// Bounds of every tile in a 1024 x 1024 z14 range, one tile at a time
+// vs. the batch and grid GlobalMercator variants
+void benchTileMath(const Options& opts, std::vector<Result>& results) {
+    const ddb::GlobalMercator mercator(256);
+    const int zoom = 14;
+    const int side = 1024;
+    const ddb::BoundingBox<ddb::Projected2Di> range(ddb::Projected2Di(8000, 5000),
+                                                     ddb::Projected2Di(8000 + side - 1, 5000 + side - 1));
+    const size_t n = static_cast<size_t>(side) * side;
+
+    std::vector<int> tx, ty;
+    tx.reserve(n);
+    ty.reserve(n);
+    for (int y = range.min.y; y <= range.max.y; y++) {
+        for (int x = range.min.x; x <= range.max.x; x++) {
+            tx.push_back(x);
+            ty.push_back(y);
+        }
+    }
+    std::vector<double> a(n), b(n), c(n), d(n);
+
+    for (const char* mode : { "single", "batch", "grid" }) {
+        for (const bool latLon : { false, true }) {
+            const std::string m = mode;
+
+            Result r;
+            r.group = "tileMath";
+            r.name = std::string(latLon ? "tileLatLonBounds/" : "tileBounds/") + mode;
+            r.params = { { "mode", mode }, { "tiles", std::to_string(n) }, { "zoom", std::to_string(zoom) } };
+            r.timing = measure([&]() {
+                if (m == "single") {
+                    for (size_t i = 0; i < n; i++) {
+                        if (latLon) {
+                            const auto g = mercator.tileLatLonBounds(tx[i], ty[i], zoom);
+                            a[i] = g.min.latitude;
+                        } else {
+                            a[i] = mercator.tileBounds(tx[i], ty[i], zoom).min.x;
+                        }
+                    }
+                } else if (m == "batch") {
+                    if (latLon)
+                        mercator.tileLatLonBounds(tx.data(), ty.data(), n, zoom, a.data(), b.data(), c.data(), d.data());
+                    else
+                        mercator.tileBounds(tx.data(), ty.data(), n, zoom, a.data(), b.data(), c.data(), d.data());
+                } else {
+                    const ddb::TileGridEdges e = latLon ? mercator.tileGridLatLonBounds(range, zoom)
+                                                        : mercator.tileGridBounds(range, zoom);
+                    a[0] = e.y[0];
+                }
+            }, opts.minTime);
+
+            r.metrics.push_back({ "megatilesPerSecond", n / r.timing.meanUs });
+            results.push_back(r);
+        }
+    }
+}
+
+void benchThumbs(const std::string& path, const std::string& dataset, const Options& opts,
+                 std::vector<Result>& results) {
+    for (int thumbSize : { 256, 1024 }) {
+        Result r;
+        r.group = "thumbs";
+        r.name = dataset + "/" + std::to_string(thumbSize);
+        r.params = { { "dataset", dataset }, { "thumbSize", std::to_string(thumbSize) } };
+
+        int bytes = 0;
+        r.timing = measure([&]() {
+            uint8_t* buf = nullptr;
+            ddb::generateImageThumb(path, thumbSize, "", &buf, &bytes);
+            VSIFree(buf);
+        }, opts.minTime, 3);
+        r.metrics.push_back({ "bytes", static_cast<double>(bytes) });
+        results.push_back(r);
+    }
+}
+
+bool selected(const Options& opts, const std::string& group) {
+    return opts.filter.empty() || opts.filter == group;
+}
+
+Options parseArgs(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::invalid_argument("Missing value for " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--out") opts.out = value();
+        else if (arg == "--work-dir") opts.workDir = value();
+        else if (arg == "--size") opts.size = std::stoi(value());
+        else if (arg == "--min-time") opts.minTime = std::stod(value());
+        else if (arg == "--input") opts.input = value();
+        else if (arg == "--filter") opts.filter = value();
+        else throw std::invalid_argument("Unknown argument " + arg);
+    }
+    return opts;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    try {
+        opts = parseArgs(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--out file] [--work-dir dir] [--size px] "
+                  << "[--min-time seconds] [--input file.tif] "
+                  << "[--filter tile|geoQuery|rescale|tileMath|hash|thumbs]" << std::endl;
+        return 1;
+    }
+
+    GDALAllRegister();
+    CPLSetConfigOption("OGR_CT_FORCE_TRADITIONAL_GIS_ORDER", "YES");
+
+    std::vector<Result> results;
+    try {
+        fs::create_directories(opts.workDir);
+
+        struct Layout {
+            GDALDataType type;
+            int bands;
+            ddb::SyntheticMask mask;
+        };
+
+        std::vector<std::pair<std::string, std::string>> datasets;
+        for (const Layout& l : { Layout{ GDT_Byte, 3, ddb::SyntheticMask::None },
+                                 Layout{ GDT_Byte, 3, ddb::SyntheticMask::AlphaBand },
+                                 Layout{ GDT_UInt16, 1, ddb::SyntheticMask::None },
+                                 Layout{ GDT_UInt16, 3, ddb::SyntheticMask::None },
+                                 Layout{ GDT_Float32, 1, ddb::SyntheticMask::AlphaBand } }) {
+            ddb::SyntheticRasterSpec spec;
+            spec.width = spec.height = opts.size;
+            spec.type = l.type;
+            spec.bands = l.bands;
+            spec.mask = l.mask;
+
+            const std::string name = ddb::syntheticRasterName(spec);
+            std::cerr << "Preparing " << name << std::endl;
+            datasets.push_back({ name, createDataset(opts.workDir, spec) });
+        }
+        if (!opts.input.empty())
+            datasets.push_back({ fs::path(opts.input).stem().string(), opts.input });
+
+        for (const auto& d : datasets) {
+            if (selected(opts, "tile") || selected(opts, "geoQuery")) {
+                std::cerr << "Benchmarking tile " << d.first << std::endl;
+                benchTile(d.second, d.first, opts, results);
+            }
+            if (selected(opts, "thumbs")) {
+                std::cerr << "Benchmarking thumbs " << d.first << std::endl;
+                benchThumbs(d.second, d.first, opts, results);
+            }
+        }
+
+        if (selected(opts, "rescale")) {
+            std::cerr << "Checking rescale kernels" << std::endl;
+            if (checkRescale() > 0) {
+                std::cerr << "Rescale kernels differ from rescaleScalar" << std::endl;
+                return 3;
+            }
+
+            std::cerr << "Benchmarking rescale" << std::endl;
+            benchRescale(opts, results);
+        }
+        if (selected(opts, "tileMath")) {
+            std::cerr << "Benchmarking tile math" << std::endl;
+            benchTileMath(opts, results);
+        }
+        if (selected(opts, "hash")) {
+            std::cerr << "Benchmarking hash" << std::endl;
+            benchHash(opts, results);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (opts.out.empty()) {
+        writeJson(std::cout, opts, results);
+    } else {
+        std::ofstream out(opts.out);
+        writeJson(out, opts, results);
+        std::cerr << "Results written to " << opts.out << std::endl;
+    }
+
+    return 0;
+}
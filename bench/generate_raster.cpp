@@ -0,0 +1,97 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+// Writes a synthetic GeoTIFF, see SyntheticRasterSpec:
+//
+//   testgenraster out.tif [--size WxH] [--type Byte|UInt16|Int16|Float32...]
+//                 [--bands n] [--block px|0] [--compress NONE|DEFLATE|LZW|ZSTD|JPEG]
+//                 [--mask none|alpha|nodata] [--nodata v] [--epsg code]
+//                 [--pixel-size meters]
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "exceptions.h"
+#include "gdal_inc.h"
+#include "synthetic_raster.h"
+
+namespace {
+
+void usage(const char* exe) {
+    std::cerr << "Usage: " << exe << " out.tif [--size WxH] [--type Byte] [--bands 3] [--block 256]"
+              << " [--compress NONE] [--mask none|alpha|nodata] [--nodata 0] [--epsg 3857]"
+              << " [--pixel-size 0.1]" << std::endl;
+}
+
+ddb::SyntheticRasterSpec parseArgs(int argc, char** argv, std::string& out) {
+    ddb::SyntheticRasterSpec spec;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::invalid_argument("Missing value for " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--size") {
+            const std::string v = value();
+            const size_t sep = v.find('x');
+            spec.width = std::stoll(v.substr(0, sep));
+            spec.height = sep == std::string::npos ? spec.width : std::stoll(v.substr(sep + 1));
+        } else if (arg == "--type") {
+            spec.type = GDALGetDataTypeByName(value().c_str());
+            if (spec.type == GDT_Unknown)
+                throw std::invalid_argument("Unknown data type");
+        } else if (arg == "--bands") {
+            spec.bands = std::stoi(value());
+        } else if (arg == "--block") {
+            spec.blockSize = std::stoi(value());
+        } else if (arg == "--compress") {
+            spec.compression = value();
+        } else if (arg == "--mask") {
+            spec.mask = ddb::parseSyntheticMask(value());
+        } else if (arg == "--nodata") {
+            spec.nodata = std::stod(value());
+        } else if (arg == "--epsg") {
+            spec.epsg = std::stoi(value());
+        } else if (arg == "--pixel-size") {
+            spec.pixelSize = std::stod(value());
+        } else if (out.empty() && arg.rfind("--", 0) != 0) {
+            out = arg;
+        } else {
+            throw std::invalid_argument("Unknown argument " + arg);
+        }
+    }
+
+    if (out.empty())
+        throw std::invalid_argument("Missing output path");
+    return spec;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string out;
+    ddb::SyntheticRasterSpec spec;
+    try {
+        spec = parseArgs(argc, argv, out);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+
+    GDALAllRegister();
+
+    try {
+        std::cout << "Writing " << ddb::syntheticRasterName(spec) << " to " << out << std::endl;
+        ddb::writeSyntheticRaster(out, spec, true);
+    } catch (const std::exception& e) {
+        std::cerr << "Generation failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,385 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+// Seeds full pyramids and generates thumbnails from synthetic rasters,
+// recording throughput and peak RSS per case. Results are compared with a
+// stored baseline and the run fails on regressions:
+//
+//   testscale [--work-dir dir] [--baseline file.json] [--update-baseline]
+//             [--tolerance 0.15] [--threads n] [--case name] [--large]
+//             [--out results.json]
+//
+// The baseline is written by the first run (or with --update-baseline) and
+// is only meaningful on the machine that recorded it.
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bench_json.h"
+#include "gdaltiler.h"
+#include "platform_utils.h"
+#include "synthetic_raster.h"
+#include "thumbs.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using ddb::jsonNumber;
+using ddb::jsonString;
+using Clock = std::chrono::steady_clock;
+
+struct ScaleCase {
+    std::string name;
+    ddb::SyntheticRasterSpec spec;
+    bool large;
+};
+
+struct CaseResult {
+    std::string name;
+    std::string raster;
+    double generateSeconds = 0.0;
+    double seedSeconds = 0.0;
+    size_t tiles = 0;
+    size_t lowZoomTiles = 0;
+    double tilesPerSecond = 0.0;
+    double megapixelsPerSecond = 0.0;
+    double thumbSeconds = 0.0;
+    double peakRssMB = 0.0;
+};
+
+// Metric, and whether a higher value is better
+const std::vector<std::pair<std::string, bool>> comparedMetrics = {
+    { "tilesPerSecond", true },
+    { "thumbSeconds", false },
+    { "peakRssMB", false },
+};
+
+struct Options {
+    fs::path workDir = fs::temp_directory_path() / "ddb-scale";
+    std::string baseline;
+    bool updateBaseline = false;
+    double tolerance = 0.15;
+    int threads = 0;
+    std::string only;
+    bool large = false;
+    std::string out;
+};
+
+ddb::SyntheticRasterSpec makeSpec(int64_t width, int64_t height, GDALDataType type, int bands,
+                                  int blockSize, const std::string& compression,
+                                  ddb::SyntheticMask mask, int epsg, double pixelSize) {
+    ddb::SyntheticRasterSpec s;
+    s.width = width;
+    s.height = height;
+    s.type = type;
+    s.bands = bands;
+    s.blockSize = blockSize;
+    s.compression = compression;
+    s.mask = mask;
+    s.nodata = type == GDT_Byte ? 0.0 : -9999.0;
+    s.epsg = epsg;
+    s.pixelSize = pixelSize;
+    return s;
+}
+
+std::vector<ScaleCase> scaleCases() {
+    using ddb::SyntheticMask;
+    return {
+        { "ortho-rgba-deflate", makeSpec(16384, 16384, GDT_Byte, 3, 512, "DEFLATE", SyntheticMask::AlphaBand, 3857, 0.05), false },
+        { "ortho-rgb-jpeg-utm", makeSpec(16384, 16384, GDT_Byte, 3, 256, "JPEG", SyntheticMask::None, 32633, 0.05), false },
+        { "dem-f32-nodata-utm", makeSpec(8192, 8192, GDT_Float32, 1, 256, "LZW", SyntheticMask::Nodata, 32633, 0.5), false },
+        { "multispectral-u16-striped", makeSpec(8192, 8192, GDT_UInt16, 5, 0, "NONE", SyntheticMask::None, 4326, 0.1), false },
+
+        // 1 cm pixels over 40 m: the windows of z0-z1 tiles exceed 2^31
+        // pixels and are dropped as sub-pixel, the zooms below them render
+        { "ortho-rgba-1cm-small", makeSpec(4096, 4096, GDT_Byte, 3, 512, "DEFLATE", SyntheticMask::AlphaBand, 3857, 0.01), false },
+
+        // 20-100 GB inputs, as processed in production
+        { "ortho-rgba-120k", makeSpec(120000, 100000, GDT_Byte, 3, 512, "DEFLATE", SyntheticMask::AlphaBand, 3857, 0.03), true },
+        { "dem-f32-100k", makeSpec(100000, 100000, GDT_Float32, 1, 256, "NONE", SyntheticMask::Nodata, 32633, 0.1), true },
+
+        // 1 cm pixels: 6.4 gigapixels, and the source window of a z0-z7 tile
+        // spans more than 2^31 pixels
+        { "ortho-rgba-1cm-80k", makeSpec(80000, 80000, GDT_Byte, 3, 512, "DEFLATE", SyntheticMask::AlphaBand, 3857, 0.01), true },
+    };
+}
+
+// Whether the alpha band of an encoded tile has any pixel that is not
+// fully transparent
+bool hasOpaquePixels(std::vector<uint8_t>& tile) {
+    const std::string path = "/vsimem/scale_suite_tile";
+    VSILFILE* f = VSIFileFromMemBuffer(path.c_str(), tile.data(), tile.size(), FALSE);
+    if (f == nullptr)
+        return false;
+    VSIFCloseL(f);
+
+    bool opaque = false;
+    GDALDatasetH ds = GDALOpen(path.c_str(), GA_ReadOnly);
+    if (ds != nullptr) {
+        const int bands = GDALGetRasterCount(ds);
+        if (bands == 2 || bands == 4) {
+            const int w = GDALGetRasterXSize(ds);
+            const int h = GDALGetRasterYSize(ds);
+            std::vector<uint8_t> alpha(static_cast<size_t>(w) * h);
+            if (GDALRasterIO(GDALGetRasterBand(ds, bands), GF_Read, 0, 0, w, h, alpha.data(), w, h,
+                             GDT_Byte, 0, 0) == CE_None)
+                opaque = std::any_of(alpha.begin(), alpha.end(), [](uint8_t a) { return a != 0; });
+        }
+        GDALClose(ds);
+    }
+    VSIUnlink(path.c_str());
+    return opaque;
+}
+
+CaseResult runCase(const ScaleCase& c, const Options& opts) {
+    CaseResult r;
+    r.name = c.name;
+    r.raster = ddb::syntheticRasterName(c.spec);
+
+    const fs::path raster = opts.workDir / (r.raster + ".tif");
+    if (!fs::exists(raster)) {
+        std::cerr << "Generating " << raster.string() << std::endl;
+        const auto start = Clock::now();
+        ddb::writeSyntheticRaster(raster.string(), c.spec, true);
+        r.generateSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    PlatformUtils::resetPeakResidentSetSize();
+
+    const fs::path tileDir = opts.workDir / "tiles" / c.name;
+    fs::remove_all(tileDir);
+    {
+        std::cerr << "Seeding " << c.name << std::endl;
+        const auto start = Clock::now();
+        ddb::GDALTiler t(raster.string(), tileDir.string(), 256, false);
+        r.tiles = t.buildPyramid(t.tMinZ, t.tMaxZ, opts.threads, true);
+        r.seedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        // Zooms above the pyramid, where the raster covers a fraction of a
+        // tile and the read window is far larger than the input. Every zoom
+        // where the raster spans a couple of canvas pixels must produce a
+        // tile with data in it. Below one pixel the window is dropped, which
+        // must not fail either, however large it gets.
+        const ddb::GlobalMercator mercator(256);
+        std::vector<ddb::TileCoord> lowZoom;
+        std::vector<int> coveredZooms, emptyZooms;
+        for (int z = 0; z < t.tMinZ; z++) {
+            const ddb::BoundingBox<ddb::Projected2Di> b = t.getMinMaxCoordsForZ(z);
+            for (int x = b.min.x; x <= b.max.x; x++)
+                for (int y = b.min.y; y <= b.max.y; y++)
+                    lowZoom.push_back({ z, x, y });
+
+            const double span = std::min(t.oMaxX - t.oMinX, t.oMaxY - t.oMinY) / mercator.resolution(z);
+            if (span >= 2.0)
+                coveredZooms.push_back(z);
+            else if (span < 0.5)
+                emptyZooms.push_back(z);
+        }
+        r.lowZoomTiles = t.renderBatch(lowZoom, opts.threads).written;
+
+        for (int z : coveredZooms) {
+            bool opaque = false;
+            for (const ddb::TileCoord& tc : lowZoom) {
+                std::vector<uint8_t> tile;
+                if (tc.z == z && t.readTile(tc.z, tc.x, tc.y, tile) && hasOpaquePixels(tile))
+                    opaque = true;
+            }
+            if (!opaque)
+                throw std::runtime_error(c.name + ": no tile with data at zoom " + std::to_string(z));
+        }
+        for (int z : emptyZooms) {
+            std::vector<uint8_t> tile;
+            for (const ddb::TileCoord& tc : lowZoom) {
+                if (tc.z == z && t.readTile(tc.z, tc.x, tc.y, tile))
+                    throw std::runtime_error(c.name + ": unexpected tile at zoom " + std::to_string(z));
+            }
+        }
+    }
+    fs::remove_all(tileDir);
+
+    if (r.seedSeconds > 0.0) {
+        r.tilesPerSecond = r.tiles / r.seedSeconds;
+        r.megapixelsPerSecond = static_cast<double>(c.spec.width) * c.spec.height / 1e6 / r.seedSeconds;
+    }
+
+    {
+        std::cerr << "Thumbnail " << c.name << std::endl;
+        const fs::path thumb = opts.workDir / (c.name + "_thumb.webp");
+        const auto start = Clock::now();
+        ddb::generateImageThumb(raster, 1024, thumb);
+        r.thumbSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+        fs::remove(thumb);
+    }
+
+    r.peakRssMB = PlatformUtils::getPeakResidentSetSize() / (1024.0 * 1024.0);
+    return r;
+}
+
+double metric(const CaseResult& r, const std::string& name) {
+    if (name == "tilesPerSecond") return r.tilesPerSecond;
+    if (name == "thumbSeconds") return r.thumbSeconds;
+    if (name == "peakRssMB") return r.peakRssMB;
+    return 0.0;
+}
+
+void writeResults(std::ostream& out, const std::vector<CaseResult>& results) {
+    out << "{\n  \"cases\": {";
+    for (size_t i = 0; i < results.size(); i++) {
+        const CaseResult& r = results[i];
+        out << (i == 0 ? "\n" : ",\n");
+        out << "    " << jsonString(r.name) << ": {"
+            << "\"raster\": " << jsonString(r.raster)
+            << ", \"tiles\": " << r.tiles
+            << ", \"lowZoomTiles\": " << r.lowZoomTiles
+            << ", \"seedSeconds\": " << jsonNumber(r.seedSeconds)
+            << ", \"tilesPerSecond\": " << jsonNumber(r.tilesPerSecond)
+            << ", \"megapixelsPerSecond\": " << jsonNumber(r.megapixelsPerSecond)
+            << ", \"thumbSeconds\": " << jsonNumber(r.thumbSeconds)
+            << ", \"peakRssMB\": " << jsonNumber(r.peakRssMB) << "}";
+    }
+    out << "\n  }\n}\n";
+}
+
+// Reads back what writeResults wrote: case name -> metric -> value
+std::map<std::string, std::map<std::string, double>> readBaseline(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string text = ss.str();
+
+    std::map<std::string, std::map<std::string, double>> baseline;
+    const std::regex caseRe("\"([^\"]+)\"\\s*:\\s*\\{([^{}]*)\\}");
+    const std::regex valueRe("\"([^\"]+)\"\\s*:\\s*(-?[0-9][0-9.eE+-]*)");
+    for (std::sregex_iterator it(text.begin(), text.end(), caseRe), end; it != end; ++it) {
+        const std::string body = (*it)[2];
+        auto& values = baseline[(*it)[1]];
+        for (std::sregex_iterator v(body.begin(), body.end(), valueRe); v != end; ++v)
+            values[(*v)[1]] = std::stod((*v)[2]);
+    }
+    return baseline;
+}
+
+// Prints regressions beyond the tolerance, returns their count
+int compare(const std::vector<CaseResult>& results,
+            const std::map<std::string, std::map<std::string, double>>& baseline, double tolerance) {
+    int regressions = 0;
+    for (const CaseResult& r : results) {
+        const auto b = baseline.find(r.name);
+        if (b == baseline.end()) {
+            std::cerr << r.name << ": no baseline" << std::endl;
+            continue;
+        }
+
+        for (const auto& m : comparedMetrics) {
+            const auto v = b->second.find(m.first);
+            if (v == b->second.end() || v->second <= 0.0)
+                continue;
+
+            const double current = metric(r, m.first);
+            const double change = (current - v->second) / v->second;
+            const bool regressed = m.second ? change < -tolerance : change > tolerance;
+
+            std::cerr << (regressed ? "REGRESSION " : "ok ") << r.name << " " << m.first << ": "
+                      << v->second << " -> " << current << " (" << (change >= 0 ? "+" : "")
+                      << change * 100.0 << "%)" << std::endl;
+            if (regressed)
+                regressions++;
+        }
+    }
+    return regressions;
+}
+
+Options parseArgs(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::invalid_argument("Missing value for " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--work-dir") opts.workDir = value();
+        else if (arg == "--baseline") opts.baseline = value();
+        else if (arg == "--update-baseline") opts.updateBaseline = true;
+        else if (arg == "--tolerance") opts.tolerance = std::stod(value());
+        else if (arg == "--threads") opts.threads = std::stoi(value());
+        else if (arg == "--case") opts.only = value();
+        else if (arg == "--large") opts.large = true;
+        else if (arg == "--out") opts.out = value();
+        else throw std::invalid_argument("Unknown argument " + arg);
+    }
+
+    if (opts.baseline.empty())
+        opts.baseline = (opts.workDir / "scale_baseline.json").string();
+    return opts;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    try {
+        opts = parseArgs(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--work-dir dir] [--baseline file.json] [--update-baseline]"
+                  << " [--tolerance 0.15] [--threads n] [--case name] [--large] [--out results.json]" << std::endl;
+        return 1;
+    }
+
+    GDALAllRegister();
+    CPLSetConfigOption("OGR_CT_FORCE_TRADITIONAL_GIS_ORDER", "YES");
+
+    std::vector<CaseResult> results;
+    try {
+        fs::create_directories(opts.workDir);
+
+        for (const ScaleCase& c : scaleCases()) {
+            if (!opts.only.empty() ? c.name != opts.only : (c.large && !opts.large))
+                continue;
+            results.push_back(runCase(c, opts));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Scale suite failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (results.empty()) {
+        std::cerr << "No case named " << opts.only << std::endl;
+        return 1;
+    }
+
+    if (opts.out.empty()) {
+        writeResults(std::cout, results);
+    } else {
+        std::ofstream out(opts.out);
+        writeResults(out, results);
+    }
+
+    if (opts.updateBaseline || !fs::exists(opts.baseline)) {
+        std::ofstream out(opts.baseline);
+        writeResults(out, results);
+        std::cerr << "Baseline written to " << opts.baseline << std::endl;
+        return 0;
+    }
+
+    const int regressions = compare(results, readBaseline(opts.baseline), opts.tolerance);
+    if (regressions > 0) {
+        std::cerr << regressions << " regression(s) against " << opts.baseline << std::endl;
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,219 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "synthetic_raster.h"
+#include "exceptions.h"
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace ddb {
+
+    namespace
+    {
+        // Valid range of the generated values per type
+        void valueRange(GDALDataType type, double& lo, double& hi)
+        {
+            switch (type)
+            {
+            case GDT_Byte:
+                lo = 1.0;
+                hi = 255.0;
+                break;
+            case GDT_UInt16:
+                lo = 1.0;
+                hi = 4095.0;
+                break;
+            case GDT_Int16:
+                lo = -500.0;
+                hi = 3000.0;
+                break;
+            default:
+                // Elevation like values
+                lo = 100.0;
+                hi = 2500.0;
+                break;
+            }
+        }
+
+        void centerInCrs(const SyntheticRasterSpec& spec, OGRSpatialReferenceH dst, double& x, double& y)
+        {
+            OGRSpatialReferenceH wgs84 = OSRNewSpatialReference(nullptr);
+            OSRImportFromEPSG(wgs84, 4326);
+            OSRSetAxisMappingStrategy(wgs84, OAMS_TRADITIONAL_GIS_ORDER);
+
+            OGRCoordinateTransformationH ct = OCTNewCoordinateTransformation(wgs84, dst);
+            OSRDestroySpatialReference(wgs84);
+            if (ct == nullptr)
+                throw GDALException("Cannot transform to EPSG:" + std::to_string(spec.epsg));
+
+            x = spec.centerLon;
+            y = spec.centerLat;
+            const bool ok = OCTTransform(ct, 1, &x, &y, nullptr) == TRUE;
+            OCTDestroyCoordinateTransformation(ct);
+            if (!ok)
+                throw GDALException("Cannot place raster center in EPSG:" + std::to_string(spec.epsg));
+        }
+    }
+
+    std::string syntheticRasterName(const SyntheticRasterSpec& spec)
+    {
+        std::string name = std::string(GDALGetDataTypeName(spec.type)) + "_" + std::to_string(spec.bands) + "b";
+        if (spec.mask == SyntheticMask::AlphaBand)
+            name += "_alpha";
+        else if (spec.mask == SyntheticMask::Nodata)
+            name += "_nodata";
+
+        name += "_" + std::to_string(spec.width) + "x" + std::to_string(spec.height);
+        name += spec.blockSize > 0 ? "_t" + std::to_string(spec.blockSize) : "_striped";
+        name += "_" + spec.compression + "_" + std::to_string(spec.epsg);
+        return name;
+    }
+
+    SyntheticMask parseSyntheticMask(const std::string& name)
+    {
+        if (name == "none")
+            return SyntheticMask::None;
+        if (name == "alpha")
+            return SyntheticMask::AlphaBand;
+        if (name == "nodata")
+            return SyntheticMask::Nodata;
+        throw GDALException("Unknown mask layout " + name + " (none, alpha, nodata)");
+    }
+
+    void writeSyntheticRaster(const std::string& path, const SyntheticRasterSpec& spec, bool progress)
+    {
+        if (spec.width <= 0 || spec.height <= 0 || spec.bands <= 0)
+            throw GDALException("Invalid synthetic raster size");
+        if (spec.width > std::numeric_limits<int>::max() || spec.height > std::numeric_limits<int>::max())
+            throw GDALException("Synthetic raster side exceeds GDAL limits");
+
+        const int width = static_cast<int>(spec.width);
+        const int height = static_cast<int>(spec.height);
+        const int bandCount = spec.bands + (spec.mask == SyntheticMask::AlphaBand ? 1 : 0);
+
+        char** opts = nullptr;
+        opts = CSLSetNameValue(opts, "COMPRESS", spec.compression.c_str());
+        opts = CSLSetNameValue(opts, "BIGTIFF", "IF_SAFER");
+        if (spec.blockSize > 0)
+        {
+            const std::string block = std::to_string(spec.blockSize);
+            opts = CSLSetNameValue(opts, "TILED", "YES");
+            opts = CSLSetNameValue(opts, "BLOCKXSIZE", block.c_str());
+            opts = CSLSetNameValue(opts, "BLOCKYSIZE", block.c_str());
+        }
+        if (spec.compression == "JPEG" && spec.bands == 3 && spec.type == GDT_Byte)
+            opts = CSLSetNameValue(opts, "PHOTOMETRIC", "YCBCR");
+
+        GDALDatasetH ds = GDALCreate(GDALGetDriverByName("GTiff"), path.c_str(), width, height,
+                                     bandCount, spec.type, opts);
+        CSLDestroy(opts);
+        if (ds == nullptr)
+            throw GDALException("Cannot create " + path + ": " + CPLGetLastErrorMsg());
+
+        OGRSpatialReferenceH srs = OSRNewSpatialReference(nullptr);
+        try
+        {
+            if (OSRImportFromEPSG(srs, spec.epsg) != OGRERR_NONE)
+                throw GDALException("Unknown CRS EPSG:" + std::to_string(spec.epsg));
+            OSRSetAxisMappingStrategy(srs, OAMS_TRADITIONAL_GIS_ORDER);
+
+            double cx, cy;
+            centerInCrs(spec, srs, cx, cy);
+
+            // Meters to degrees of latitude, good enough for test data
+            const double res = OSRIsGeographic(srs) ? spec.pixelSize / 111320.0 : spec.pixelSize;
+            double gt[6] = { cx - res * spec.width / 2.0, res, 0.0, cy + res * spec.height / 2.0, 0.0, -res };
+            GDALSetGeoTransform(ds, gt);
+
+            char* wkt = nullptr;
+            OSRExportToWkt(srs, &wkt);
+            GDALSetProjection(ds, wkt);
+            CPLFree(wkt);
+        }
+        catch (...)
+        {
+            OSRDestroySpatialReference(srs);
+            GDALClose(ds);
+            throw;
+        }
+        OSRDestroySpatialReference(srs);
+
+        for (int b = 0; b < bandCount; b++)
+        {
+            GDALRasterBandH band = GDALGetRasterBand(ds, b + 1);
+            if (b == spec.bands)
+                GDALSetRasterColorInterpretation(band, GCI_AlphaBand);
+            else if (spec.mask == SyntheticMask::Nodata)
+                GDALSetRasterNoDataValue(band, spec.nodata);
+            else if (spec.bands >= 3 && b < 3)
+                GDALSetRasterColorInterpretation(band, static_cast<GDALColorInterp>(GCI_RedBand + b));
+        }
+
+        double lo, hi;
+        valueRange(spec.type, lo, hi);
+
+        // Chunks are aligned on whole blocks so that each block is written once
+        const int chunkRows = spec.blockSize > 0 ? spec.blockSize : 64;
+        const int chunkCols = spec.blockSize > 0 ? std::min(width, spec.blockSize * 16) : width;
+        std::vector<double> chunk(static_cast<size_t>(chunkRows) * chunkCols);
+
+        const double rx = spec.width / 2.0, ry = spec.height / 2.0;
+
+        for (int y0 = 0; y0 < height; y0 += chunkRows)
+        {
+            const int rows = std::min(chunkRows, height - y0);
+            for (int x0 = 0; x0 < width; x0 += chunkCols)
+            {
+                const int cols = std::min(chunkCols, width - x0);
+                for (int b = 0; b < bandCount; b++)
+                {
+                    const bool isAlpha = b == spec.bands;
+                    for (int r = 0; r < rows; r++)
+                    {
+                        const int64_t y = y0 + r;
+                        const double dy = (static_cast<double>(y) + 0.5 - ry) / ry;
+                        double* row = chunk.data() + static_cast<size_t>(r) * cols;
+                        for (int c = 0; c < cols; c++)
+                        {
+                            const int64_t x = x0 + c;
+                            const double dx = (static_cast<double>(x) + 0.5 - rx) / rx;
+                            const bool inside = spec.mask == SyntheticMask::None || dx * dx + dy * dy <= 1.0;
+
+                            if (isAlpha)
+                            {
+                                row[c] = inside ? 255.0 : 0.0;
+                            }
+                            else if (!inside)
+                            {
+                                row[c] = spec.nodata;
+                            }
+                            else
+                            {
+                                // Ramp across the raster plus a 64 px texture
+                                const double ramp = (static_cast<double>(x) / spec.width +
+                                                     static_cast<double>(y) / spec.height * (b + 1)) / (b + 2);
+                                const double texture = static_cast<double>(((x ^ y) + b * 21) & 63) / 63.0;
+                                row[c] = lo + (hi - lo) * (0.85 * ramp + 0.15 * texture);
+                            }
+                        }
+                    }
+
+                    if (GDALRasterIO(GDALGetRasterBand(ds, b + 1), GF_Write, x0, y0, cols, rows, chunk.data(),
+                                     cols, rows, GDT_Float64, 0, 0) != CE_None)
+                    {
+                        GDALClose(ds);
+                        throw GDALException("Cannot write " + path + ": " + CPLGetLastErrorMsg());
+                    }
+                }
+            }
+
+            if (progress)
+                GDALTermProgress(static_cast<double>(y0 + rows) / height, nullptr, nullptr);
+        }
+
+        GDALClose(ds);
+    }
+
+}
@@ -0,0 +1,63 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "gdal_inc.h"
+
+namespace ddb {
+
+    // How the area outside the valid data is marked
+    enum class SyntheticMask
+    {
+        // Every pixel is valid
+        None,
+
+        // Extra alpha band, 0 outside the valid area
+        AlphaBand,
+
+        // Pixels outside the valid area hold the band nodata value
+        Nodata
+    };
+
+    struct SyntheticRasterSpec
+    {
+        int64_t width = 2048;
+        int64_t height = 2048;
+        GDALDataType type = GDT_Byte;
+
+        // Data bands, not counting the alpha band
+        int bands = 3;
+
+        // Square internal tiles, 0 writes a striped GeoTIFF
+        int blockSize = 256;
+
+        // GTiff COMPRESS value (NONE, DEFLATE, LZW, ZSTD, JPEG...)
+        std::string compression = "NONE";
+
+        SyntheticMask mask = SyntheticMask::None;
+        double nodata = 0.0;
+
+        int epsg = 3857;
+
+        // Ground size of a pixel in meters, converted to degrees for
+        // geographic CRSs. The raster is centered on centerLon/centerLat.
+        double pixelSize = 0.1;
+        double centerLon = 17.03;
+        double centerLat = 51.11;
+    };
+
+    // Writes a GeoTIFF with deterministic content: ramps plus a repeating
+    // texture (so that compression has work to do), an elliptic valid area
+    // when masked. Memory use does not depend on the raster size, and files
+    // over 4 GB are written as BigTIFF.
+    void writeSyntheticRaster(const std::string& path, const SyntheticRasterSpec& spec, bool progress = false);
+
+    // Short description usable in file names, e.g. Byte_3b_alpha_8192x8192_t256_DEFLATE_3857
+    std::string syntheticRasterName(const SyntheticRasterSpec& spec);
+
+    SyntheticMask parseSyntheticMask(const std::string& name);
+
+}
@@ -1,5 +1,8 @@
 #include <iostream>
 #include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <cstring>
 #include <vector>
 #include "src/hash.h"
 #include "src/platform_utils.h"
@@ -80,6 +83,29 @@ void testGDALTiler(const std::string& wroFilePath, const std::string& executable
             }
         }
 
+        // Same tile rendered in memory must match the one written to disk.
+        // Forced, so the buffer is not just the stored tile read back.
+        const auto& first = testTiles.front();
+        uint8_t* tileBuffer = nullptr;
+        int tileBufferSize = 0;
+        try {
+            t.setForceRender(true);
+            t.tile(first.z, first.x, first.y, &tileBuffer, &tileBufferSize);
+            t.setForceRender(false);
+
+            std::ifstream disk(t.getTilePath(first.z, first.x, first.y), std::ios::binary);
+            const std::vector<char> diskTile((std::istreambuf_iterator<char>(disk)), std::istreambuf_iterator<char>());
+            if (disk.is_open() && diskTile.size() == static_cast<size_t>(tileBufferSize) &&
+                std::memcmp(diskTile.data(), tileBuffer, diskTile.size()) == 0) {
+                std::cout << "✓ In-memory tile matches disk tile (" << tileBufferSize << " bytes)" << std::endl;
+            } else {
+                std::cout << "✗ In-memory tile differs from disk tile (" << tileBufferSize << " bytes)" << std::endl;
+            }
+        } catch (const std::exception& e) {
+            std::cout << "✗ Error generating in-memory tile: " << e.what() << std::endl;
+        }
+        VSIFree(tileBuffer);
+
         std::cout << "GDALTiler bug reproduction test completed" << std::endl;
 
     } catch (const std::exception& e) {
@@ -0,0 +1,126 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "dataset_pool.h"
+#include <algorithm>
+
+namespace ddb
+{
+
+    DatasetPool::Lease::Lease(DatasetPool* pool, TileDatasets ds) : pool(pool), ds(std::move(ds))
+    {
+    }
+
+    DatasetPool::Lease::Lease(Lease&& other) noexcept : pool(other.pool), ds(std::move(other.ds))
+    {
+        other.pool = nullptr;
+    }
+
+    DatasetPool::Lease::~Lease()
+    {
+        if (pool != nullptr)
+            pool->release(ds);
+    }
+
+    DatasetPool::DatasetPool(size_t capacity, Opener open, Closer close, const TileDatasets& seed)
+        : open(std::move(open)), close(std::move(close)), capacity(std::max<size_t>(1, capacity)),
+          pinned(seed.input)
+    {
+        idle.push_back(seed);
+        opened = 1;
+    }
+
+    DatasetPool::~DatasetPool()
+    {
+        // Leases must not outlive the pool
+        for (auto& ds : idle)
+            close(ds);
+    }
+
+    DatasetPool::Lease DatasetPool::acquire()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        available.wait(lock, [this]() { return !idle.empty() || opened < capacity; });
+
+        if (!idle.empty())
+        {
+            // Most recently returned first, its caches are the warmest
+            TileDatasets ds = idle.back();
+            idle.pop_back();
+            return Lease(this, ds);
+        }
+
+        // Open outside the lock, it parses the SRS and builds the VRT
+        opened++;
+        lock.unlock();
+
+        try
+        {
+            return Lease(this, open());
+        }
+        catch (...)
+        {
+            lock.lock();
+            opened--;
+            lock.unlock();
+            available.notify_one();
+            throw;
+        }
+    }
+
+    void DatasetPool::release(TileDatasets& ds)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (opened > capacity && !isPinned(ds))
+        {
+            opened--;
+            lock.unlock();
+            close(ds);
+            return;
+        }
+
+        idle.push_back(ds);
+        lock.unlock();
+        available.notify_one();
+    }
+
+    void DatasetPool::setCapacity(size_t capacity)
+    {
+        std::vector<TileDatasets> excess;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->capacity = std::max<size_t>(1, capacity);
+            for (auto it = idle.begin(); it != idle.end() && opened > this->capacity;)
+            {
+                if (isPinned(*it))
+                {
+                    ++it;
+                    continue;
+                }
+                excess.push_back(*it);
+                it = idle.erase(it);
+                opened--;
+            }
+        }
+
+        for (auto& ds : excess)
+            close(ds);
+        available.notify_all();
+    }
+
+    size_t DatasetPool::getCapacity() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return capacity;
+    }
+
+    size_t DatasetPool::openCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return opened;
+    }
+
+}
@@ -0,0 +1,92 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "gdal_inc.h"
+#include "tile_warper.h"
+
+namespace ddb {
+
+    // Handles a tile is read from. When the input is not in EPSG:3857,
+    // input is a warped VRT and orig is the dataset it wraps. With tile
+    // warping enabled, warper reads from orig in place of the VRT.
+    struct TileDatasets
+    {
+        GDALDatasetH input = nullptr;
+        GDALDatasetH orig = nullptr;
+        std::shared_ptr<TileWarper> warper;
+    };
+
+    // Bounded set of TileDatasets shared by concurrent readers. GDAL handles
+    // must not be used by two threads at once, so each reader checks a set
+    // out for the duration of a tile and returns it afterwards. Sets are
+    // opened on demand up to capacity; past that, acquire() waits for a return.
+    class DatasetPool
+    {
+    public:
+        using Opener = std::function<TileDatasets()>;
+        using Closer = std::function<void(TileDatasets&)>;
+
+        // Exclusive use of one set of handles, returned on destruction
+        class Lease
+        {
+        public:
+            Lease(DatasetPool* pool, TileDatasets ds);
+            Lease(Lease&& other) noexcept;
+            ~Lease();
+
+            Lease(const Lease&) = delete;
+            Lease& operator=(const Lease&) = delete;
+            Lease& operator=(Lease&&) = delete;
+
+            const TileDatasets& operator*() const { return ds; }
+            const TileDatasets* operator->() const { return &ds; }
+
+        private:
+            DatasetPool* pool;
+            TileDatasets ds;
+        };
+
+        // seed is an already open set the pool takes ownership of. The owner
+        // keeps using it outside of leases (metadata, warp cache builds), so
+        // it stays open until the pool is destroyed, whatever the capacity.
+        DatasetPool(size_t capacity, Opener open, Closer close, const TileDatasets& seed);
+        ~DatasetPool();
+
+        DatasetPool(const DatasetPool&) = delete;
+        DatasetPool& operator=(const DatasetPool&) = delete;
+
+        Lease acquire();
+
+        // Handles above the new capacity are closed as they become idle,
+        // except for the seed
+        void setCapacity(size_t capacity);
+        size_t getCapacity() const;
+
+        // Sets currently open, idle or checked out
+        size_t openCount() const;
+
+    private:
+        Opener open;
+        Closer close;
+
+        mutable std::mutex mutex;
+        std::condition_variable available;
+        size_t capacity;
+        size_t opened = 0;
+        std::vector<TileDatasets> idle;
+
+        // Input handle of the seed set, never closed before the pool
+        GDALDatasetH pinned;
+        bool isPinned(const TileDatasets& ds) const { return ds.input == pinned; }
+
+        void release(TileDatasets& ds);
+    };
+
+}
@@ -11,4 +11,9 @@ public:
     GDALException(const std::string& message) : std::runtime_error(message) {}
 };
 
+class DBException : public std::runtime_error {
+public:
+    DBException(const std::string& message) : std::runtime_error(message) {}
+};
+
 } // namespace ddb
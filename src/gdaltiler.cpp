@@ -4,15 +4,73 @@
 
 #include "gdaltiler.h"
 #include "exceptions.h"
+#include "hash.h"
+#include "rescale.h"
+#include "logger.h"
+#include "tile_arena.h"
+#include "tile_schedule.h"
+#include "work_stealing_pool.h"
+#include "bounded_queue.h"
+#include "seed_checkpoint.h"
+#include <algorithm>
 #include <memory>
-#include <iostream>
 #include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
 
 namespace fs = std::filesystem;
 
 namespace ddb
 {
 
+    namespace
+    {
+        // Canvas for the tiles rendered on this thread that are stored right away
+        TileCanvas& scratchCanvas()
+        {
+            static thread_local TileCanvas canvas;
+            return canvas;
+        }
+
+        // Canvas a metatile is rendered into before being sliced
+        TileCanvas& scratchMetatile()
+        {
+            static thread_local TileCanvas canvas;
+            return canvas;
+        }
+
+        // Set on the tiler's own worker threads, see TileWarpOptions::threads
+        thread_local bool onWorker = false;
+
+        // Sets a flag for the lifetime of the guard
+        class FlagGuard
+        {
+        public:
+            FlagGuard(bool& flag, bool value) : flag(flag), saved(flag) { flag = value; }
+            ~FlagGuard() { flag = saved; }
+
+            FlagGuard(const FlagGuard&) = delete;
+            FlagGuard& operator=(const FlagGuard&) = delete;
+
+        private:
+            bool& flag;
+            bool saved;
+        };
+
+        int floorDiv(int a, int b)
+        {
+            return a >= 0 ? a / b : -((-a + b - 1) / b);
+        }
+    }
+
     bool GDALTiler::hasGeoreference(const GDALDatasetH& dataset)
     {
         double geo[6] = { 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 };
@@ -54,30 +112,131 @@ namespace ddb
         if (pngDrv == nullptr)
             throw GDALException("Cannot create PNG driver");
 
+        // Unknown times make every stored tile look stale
+        std::error_code ec;
+        sourceTime = std::filesystem::last_write_time(inputPath, ec);
+        if (ec)
+            sourceTime = std::filesystem::file_time_type::max();
+
         memDrv = GDALGetDriverByName("MEM");
         if (memDrv == nullptr)
             throw GDALException("Cannot create MEM driver");
 
-        std::string openPath = inputPath;
+        setEncoder(TileEncoderOptions());
 
-        inputDataset = GDALOpen(inputPath.c_str(), GA_ReadOnly);
-        if (inputDataset == nullptr)
-            throw GDALException("Cannot open " + inputPath);
+        datasets = openDatasets();
+        handles.reset(new DatasetPool(std::max(1u, std::thread::hardware_concurrency()),
+                                      [this]() { return openDatasets(); },
+                                      [this](TileDatasets& ds) { closeDatasets(ds); }, datasets));
+
+        // TODO: nodata?
+        // if (inNodata.size() > 0){
+        //        update_no_data_values
+        //}
+
+        // warped_input_dataset = inputDataset
+        nBands = dataBandsCount(datasets.input);
+
+        double outGt[6];
+        if (GDALGetGeoTransform(datasets.input, outGt) != CE_None)
+            throw GDALException("Cannot fetch geotransform outGt");
+
+        // Validate geotransform values
+        if (std::abs(outGt[1]) < std::numeric_limits<double>::epsilon() ||
+            std::abs(outGt[5]) < std::numeric_limits<double>::epsilon())
+        {
+            throw GDALException("Invalid geotransform: pixel size is zero");
+        }
+
+        oMinX = outGt[0];
+        oMaxX = outGt[0] + GDALGetRasterXSize(datasets.input) * outGt[1];
+        oMaxY = outGt[3];
+        oMinY = outGt[3] - GDALGetRasterYSize(datasets.input) * outGt[1];
+
+        DDB_LOG(Info) << "Bounds (output SRS): " << oMinX << "," << oMinY << "," << oMaxX
+            << "," << oMaxY;
+
+        // Max/min zoom level
+        tMaxZ = mercator.zoomForPixelSize(outGt[1]);
+        tMinZ = mercator.zoomForPixelSize(outGt[1] *
+            std::max(GDALGetRasterXSize(datasets.input),
+                GDALGetRasterYSize(datasets.input)) /
+            tileSize);
+
+        DDB_LOG(Info) << "MinZ: " << tMinZ;
+        DDB_LOG(Info) << "MaxZ: " << tMaxZ;
+        DDB_LOG(Info) << "Num bands: " << nBands;
+
+        const GDALDataType type = GDALGetRasterDataType(GDALGetRasterBand(datasets.input, 1));
+        if (type != GDT_Byte && type != GDT_Unknown)
+            computeStatistics();
+    }
+
+    void GDALTiler::computeStatistics()
+    {
+        globalMin = std::numeric_limits<double>::max();
+        globalMax = std::numeric_limits<double>::lowest();
+
+        // Use the actual dataset, not the VRT
+        GDALDatasetH ds = datasets.orig != nullptr ? datasets.orig : datasets.input;
+
+        const int cappedBands = std::min(3, nBands);
+        for (int i = 0; i < cappedBands; i++)
+        {
+            double bMin, bMax;
+            GDALRasterBandH hBand = GDALGetRasterBand(ds, i + 1);
+
+            // Reuses statistics from the dataset metadata or its .aux.xml sidecar
+            CPLErr statsRes = GDALGetRasterStatistics(hBand, TRUE, FALSE, &bMin, &bMax, nullptr, nullptr);
+            if (statsRes == CE_Warning)
+            {
+                double bMean, bStdDev;
+                if (GDALGetRasterStatistics(hBand, TRUE, TRUE, &bMin, &bMax, &bMean, &bStdDev) != CE_None)
+                    throw GDALException("Cannot compute band statistics (forced)");
+
+                // Persisted to the sidecar when the dataset is closed
+                if (GDALSetRasterStatistics(hBand, bMin, bMax, bMean, bStdDev) != CE_None)
+                    throw GDALException("Cannot cache band statistics");
+
+                DDB_LOG(Info) << "Cached band " << i << " statistics (" << bMin << ", " << bMax << ")";
+            }
+            else if (statsRes == CE_Failure)
+            {
+                throw GDALException("Cannot compute band statistics");
+            }
+
+            globalMin = std::min(globalMin, bMin);
+            globalMax = std::max(globalMax, bMax);
+        }
+
+        hasStatistics = true;
+    }
 
-        nBands = GDALGetRasterCount(inputDataset);
-        if (nBands == 0)
-            throw GDALException("No raster bands found in " + inputPath);
+    TileDatasets GDALTiler::openDatasets()
+    {
+        const std::string openPath = materializedPath.empty() ? inputPath : materializedPath;
+
+        TileDatasets ds;
+        ds.input = GDALOpen(openPath.c_str(), GA_ReadOnly);
+        if (ds.input == nullptr)
+            throw GDALException("Cannot open " + openPath);
+
+        if (GDALGetRasterCount(ds.input) == 0)
+        {
+            GDALClose(ds.input);
+            throw GDALException("No raster bands found in " + openPath);
+        }
 
         // Extract input SRS
         const OGRSpatialReferenceH inputSrs = OSRNewSpatialReference(nullptr);
         std::string inputSrsWkt;
-        if (GDALGetProjectionRef(inputDataset) != nullptr)
+        if (GDALGetProjectionRef(ds.input) != nullptr)
         {
-            inputSrsWkt = GDALGetProjectionRef(inputDataset);
+            inputSrsWkt = GDALGetProjectionRef(ds.input);
         }
-        else if (GDALGetGCPCount(inputDataset) > 0)
+        else if (GDALGetGCPCount(ds.input) > 0)
         {
-            inputSrsWkt = GDALGetGCPProjection(inputDataset);
+            inputSrsWkt = GDALGetGCPProjection(ds.input);
         }
         else
         {
@@ -96,56 +255,166 @@ namespace ddb
 
         // OSRSetAxisMappingStrategy(outputSrs, OSRAxisMappingStrategy::OAMS_TRADITIONAL_GIS_ORDER);
 
-        if (!hasGeoreference(inputDataset))
+        if (!hasGeoreference(ds.input))
             throw GDALException(openPath + " is not georeferenced.");
 
         // Check if we need to reproject
         if (!sameProjection(inputSrs, outputSrs))
         {
-            origDataset = inputDataset;
-            inputDataset = createWarpedVRT(inputDataset, outputSrs);
+            ds.orig = ds.input;
+            ds.input = createWarpedVRT(ds.input, outputSrs);
+
+            // The VRT stays open for the tile geometry
+            if (tileWarping)
+                ds.warper = std::make_shared<TileWarper>(ds.orig, memDrv, tileSize, std::min(3, nBands), warpOptions);
         }
 
         OSRDestroySpatialReference(inputSrs);
         OSRDestroySpatialReference(outputSrs);
 
-        // TODO: nodata?
-        // if (inNodata.size() > 0){
-        //        update_no_data_values
-        //}
+        return ds;
+    }
 
-        // warped_input_dataset = inputDataset
-        nBands = dataBandsCount(inputDataset);
+    void GDALTiler::enableWarpCache(const std::string& cacheDir)
+    {
+        // Already in EPSG:3857, tiles are read without warping
+        if (datasets.orig == nullptr)
+            return;
 
-        double outGt[6];
-        if (GDALGetGeoTransform(inputDataset, outGt) != CE_None)
-            throw GDALException("Cannot fetch geotransform outGt");
+        const std::string cogPath = buildWarpCache(cacheDir);
 
-        // Validate geotransform values
-        if (std::abs(outGt[1]) < std::numeric_limits<double>::epsilon() ||
-            std::abs(outGt[5]) < std::numeric_limits<double>::epsilon())
+        materializedPath = cogPath;
+        reopenDatasets();
+    }
+
+    std::string GDALTiler::buildWarpCache(const std::string& cacheDir)
+    {
+        std::error_code ec;
+        const uintmax_t size = fs::file_size(inputPath, ec);
+        const auto mtime = fs::last_write_time(inputPath, ec);
+        if (ec)
+            throw GDALException("Cannot stat " + inputPath + ": " + ec.message());
+
+        // <input>_<version>.tif: the first part finds older copies of the same
+        // input, the second changes whenever the input does
+        const std::string inputKey = Hash::strCRC64(fs::absolute(inputPath).string());
+        const std::string versionKey = Hash::strCRC64(std::to_string(size) + "_" +
+                                                      std::to_string(mtime.time_since_epoch().count()) + "_" +
+                                                      std::to_string(tileSize));
+        const std::string cogName = inputKey + "_" + versionKey + ".tif";
+        const fs::path cogPath = fs::path(cacheDir) / cogName;
+
+        if (fs::exists(cogPath))
+            return cogPath.string();
+
+        fs::create_directories(cacheDir, ec);
+        if (ec)
+            throw GDALException("Cannot create warp cache folder " + cacheDir + ": " + ec.message());
+
+        DDB_LOG(Info) << "Building EPSG:3857 cache " << cogPath;
+
+        // Same reprojection as createWarpedVRT, done once
+        char** targs = nullptr;
+        targs = CSLAddString(targs, "-t_srs");
+        targs = CSLAddString(targs, "EPSG:3857");
+        targs = CSLAddString(targs, "-r");
+        targs = CSLAddString(targs, "near");
+        targs = CSLAddString(targs, "-et");
+        targs = CSLAddString(targs, "0.001");
+        if (FindAlphaBand(datasets.orig) == nullptr)
+            targs = CSLAddString(targs, "-dstalpha");
+        targs = CSLAddString(targs, "-multi");
+        targs = CSLAddString(targs, "-wo");
+        targs = CSLAddString(targs, "NUM_THREADS=ALL_CPUS");
+        targs = CSLAddString(targs, "-of");
+        targs = CSLAddString(targs, "COG");
+        targs = CSLAddString(targs, "-co");
+        targs = CSLAddString(targs, ("BLOCKSIZE=" + std::to_string(tileSize)).c_str());
+        targs = CSLAddString(targs, "-co");
+        targs = CSLAddString(targs, "COMPRESS=DEFLATE");
+        targs = CSLAddString(targs, "-co");
+        targs = CSLAddString(targs, "OVERVIEW_RESAMPLING=NEAREST");
+        targs = CSLAddString(targs, "-co");
+        targs = CSLAddString(targs, "NUM_THREADS=ALL_CPUS");
+        targs = CSLAddString(targs, "-co");
+        targs = CSLAddString(targs, "BIGTIFF=IF_SAFER");
+
+        GDALWarpAppOptions* psOptions = GDALWarpAppOptionsNew(targs, nullptr);
+        CSLDestroy(targs);
+        if (psOptions == nullptr)
+            throw GDALException("Cannot create warp options");
+
+        // Written under a temporary name so that other tilers never open a partial file
+        const std::string tmpPath = cogPath.string() + "." +
+            std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp.tif";
+        GDALDatasetH src = datasets.orig;
+        GDALDatasetH hNewDataset = GDALWarp(tmpPath.c_str(), nullptr, 1, &src, psOptions, nullptr);
+        GDALWarpAppOptionsFree(psOptions);
+
+        if (hNewDataset == nullptr)
         {
-            throw GDALException("Invalid geotransform: pixel size is zero");
+            fs::remove(tmpPath, ec);
+            throw GDALException("Cannot build warp cache for " + inputPath);
         }
+        GDALClose(hNewDataset);
 
-        oMinX = outGt[0];
-        oMaxX = outGt[0] + GDALGetRasterXSize(inputDataset) * outGt[1];
-        oMaxY = outGt[3];
-        oMinY = outGt[3] - GDALGetRasterYSize(inputDataset) * outGt[1];
+        fs::rename(tmpPath, cogPath, ec);
+        if (ec)
+        {
+            fs::remove(tmpPath, ec);
+            throw GDALException("Cannot write warp cache " + cogPath.string() + ": " + ec.message());
+        }
 
-        std::cout << "Bounds (output SRS): " << oMinX << "," << oMinY << "," << oMaxX
-            << "," << oMaxY << std::endl;
+        // Drop copies made from previous versions of the input
+        for (const auto& entry : fs::directory_iterator(cacheDir, ec))
+        {
+            const std::string name = entry.path().filename().string();
+            if (name != cogName && name.rfind(inputKey + "_", 0) == 0 && name.find(".tmp") == std::string::npos)
+                fs::remove(entry.path(), ec);
+        }
 
-        // Max/min zoom level
-        tMaxZ = mercator.zoomForPixelSize(outGt[1]);
-        tMinZ = mercator.zoomForPixelSize(outGt[1] *
-            std::max(GDALGetRasterXSize(inputDataset),
-                GDALGetRasterYSize(inputDataset)) /
-            tileSize);
+        return cogPath.string();
+    }
+
+    void GDALTiler::enableTileWarping(const TileWarpOptions& options)
+    {
+        if (datasets.orig == nullptr)
+            return;
+
+        warpOptions = options;
+        tileWarping = true;
+
+        reopenDatasets();
+    }
+
+    void GDALTiler::reopenDatasets()
+    {
+        // The pool owns every open set, including datasets
+        const size_t capacity = handles->getCapacity();
+        datasets = TileDatasets();
+        handles.reset();
+
+        datasets = openDatasets();
+        handles.reset(new DatasetPool(capacity,
+                                      [this]() { return openDatasets(); },
+                                      [this](TileDatasets& ds) { closeDatasets(ds); }, datasets));
+    }
+
+    void GDALTiler::setMaxDatasetHandles(size_t handles)
+    {
+        this->handles->setCapacity(handles);
+    }
 
-        std::cout << "MinZ: " << tMinZ << std::endl;
-        std::cout << "MaxZ: " << tMaxZ << std::endl;
-        std::cout << "Num bands: " << nBands << std::endl;
+    void GDALTiler::closeDatasets(TileDatasets& ds)
+    {
+        // Close the warper and the warped VRT before the dataset they read from
+        ds.warper.reset();
+        if (ds.input)
+            GDALClose(ds.input);
+        if (ds.orig)
+            GDALClose(ds.orig);
+        ds.input = nullptr;
+        ds.orig = nullptr;
     }
 
     GDALDatasetH GDALTiler::createWarpedVRT(const GDALDatasetH& src,
@@ -216,8 +485,9 @@ namespace ddb
 
     GDALTiler::~GDALTiler()
     {
-        if (inputDataset)
-            GDALClose(inputDataset);
+        datasets = TileDatasets();
+        handles.reset();
+        CSLDestroy(encoderCreateOptions);
     }
 
     GQResult GDALTiler::geoQuery(GDALDatasetH ds, double ulx, double uly, double lrx,
@@ -235,10 +505,10 @@ namespace ddb
             throw GDALException("Invalid geotransform: pixel size is zero");
         }
 
-        o.r.x = static_cast<int>((ulx - geo[0]) / geo[1] + 0.001);
-        o.r.y = static_cast<int>((uly - geo[3]) / geo[5] + 0.001);
-        o.r.xsize = static_cast<int>((lrx - ulx) / geo[1] + 0.5);
-        o.r.ysize = static_cast<int>((lry - uly) / geo[5] + 0.5);
+        o.r.x = static_cast<int64_t>((ulx - geo[0]) / geo[1] + 0.001);
+        o.r.y = static_cast<int64_t>((uly - geo[3]) / geo[5] + 0.001);
+        o.r.xsize = static_cast<int64_t>((lrx - ulx) / geo[1] + 0.5);
+        o.r.ysize = static_cast<int64_t>((lry - uly) / geo[5] + 0.5);
 
         if (querySize == 0)
         {
@@ -254,28 +524,28 @@ namespace ddb
         o.w.x = 0;
         if (o.r.x < 0)
         {
-            const int rxShift = std::abs(o.r.x);
+            const int64_t rxShift = std::abs(o.r.x);
             if (o.r.xsize > 0)
             {
-                o.w.x = static_cast<int>(o.w.xsize * (static_cast<double>(rxShift) /
+                o.w.x = static_cast<int64_t>(o.w.xsize * (static_cast<double>(rxShift) /
                                                       static_cast<double>(o.r.xsize)));
                 o.w.xsize = o.w.xsize - o.w.x;
                 o.r.xsize =
                     o.r.xsize -
-                    static_cast<int>(o.r.xsize * (static_cast<double>(rxShift) /
+                    static_cast<int64_t>(o.r.xsize * (static_cast<double>(rxShift) /
                                                   static_cast<double>(o.r.xsize)));
             }
             o.r.x = 0;
         }
 
-        const int rasterXSize = GDALGetRasterXSize(ds);
-        const int rasterYSize = GDALGetRasterYSize(ds);
+        const int64_t rasterXSize = GDALGetRasterXSize(ds);
+        const int64_t rasterYSize = GDALGetRasterYSize(ds);
 
         if (o.r.x + o.r.xsize > rasterXSize)
         {
             if (o.r.xsize > 0)
             {
-                o.w.xsize = static_cast<int>(
+                o.w.xsize = static_cast<int64_t>(
                     o.w.xsize *
                     (static_cast<double>(rasterXSize) - static_cast<double>(o.r.x)) /
                     static_cast<double>(o.r.xsize));
@@ -286,15 +556,15 @@ namespace ddb
         o.w.y = 0;
         if (o.r.y < 0)
         {
-            const int ryShift = std::abs(o.r.y);
+            const int64_t ryShift = std::abs(o.r.y);
             if (o.r.ysize > 0)
             {
-                o.w.y = static_cast<int>(o.w.ysize * (static_cast<double>(ryShift) /
+                o.w.y = static_cast<int64_t>(o.w.ysize * (static_cast<double>(ryShift) /
                                                       static_cast<double>(o.r.ysize)));
                 o.w.ysize = o.w.ysize - o.w.y;
                 o.r.ysize =
                     o.r.ysize -
-                    static_cast<int>(o.r.ysize * (static_cast<double>(ryShift) /
+                    static_cast<int64_t>(o.r.ysize * (static_cast<double>(ryShift) /
                                                   static_cast<double>(o.r.ysize)));
             }
             o.r.y = 0;
@@ -304,7 +574,7 @@ namespace ddb
         {
             if (o.r.ysize > 0)
             {
-                o.w.ysize = static_cast<int>(
+                o.w.ysize = static_cast<int64_t>(
                     o.w.ysize *
                     (static_cast<double>(rasterYSize) - static_cast<double>(o.r.y)) /
                     static_cast<double>(o.r.ysize));
@@ -324,46 +594,54 @@ namespace ddb
         if (bMin == bMax)
             bMax += 0.1;
 
-        std::cout << "Min: " << bMin << " | Max: " << bMax << std::endl;
-
         // Can still happen according to GDAL for very large values
         if (bMin == bMax)
             throw GDALException(
                 "Cannot scale values due to source min/max being equal");
 
-        double deltamm = bMax - bMin;
-
-        for (size_t i = 0; i < bufsize; i++)
-        {
-            double v = std::max(bMin, std::min(bMax, static_cast<double>(ptr[i])));
-            dstBuffer[i] = static_cast<uint8_t>(255.0 * (v - bMin) / deltamm);
-        }
+        rescaleBuffer<T>(ptr, dstBuffer, bufsize, bMin, bMax);
     }
 
-    std::string GDALTiler::tile(int tz, int tx, int ty)
+    std::string GDALTiler::tile(int tz, int tx, int ty, uint8_t **outBuffer, int *outBufferSize)
     {
-        std::string tilePath = getTilePath(tz, tx, ty);
+        const bool writeToMemory = outBuffer != nullptr;
+        const int outY = ty;
 
-        // Create folders for the tile
+        syncFreshness();
+
+        const TileCacheKey cacheKey{ tz, tx, ty, tileSize, tileExtension, cacheSource };
+        std::vector<uint8_t> cached;
+        if (cache && cache->get(cacheKey, cached))
+        {
+            if (!writeToMemory)
+                return writeToSink(tz, tx, outY, cached.data(), cached.size());
+
+            *outBuffer = static_cast<uint8_t*>(VSIMalloc(cached.size()));
+            if (*outBuffer == nullptr)
+                throw GDALException("Cannot allocate tile buffer");
+            std::memcpy(*outBuffer, cached.data(), cached.size());
+            if (outBufferSize != nullptr)
+                *outBufferSize = static_cast<int>(cached.size());
+            return "";
+        }
 
-        // Get the parent directory
-        fs::path dirPath = fs::path(tilePath).parent_path();
+        if (isFresh(tz, tx, outY))
+        {
+            if (!writeToMemory)
+                return getTilePath(tz, tx, outY);
 
-        // Create directories if they don't exist
-        std::error_code ec;
-        if (!fs::exists(dirPath)) {
-            if (fs::create_directories(dirPath, ec)) {
-                std::cout << "Directories created: " << dirPath << "\n";
-            }
-            else if (ec) {
-                std::cerr << "Error creating directories: " << ec.message() << "\n";
-                throw GDALException("Cannot create directories for tile path: " + dirPath.string());
+            std::vector<uint8_t> stored;
+            if (sink->read(tz, tx, outY, stored))
+            {
+                *outBuffer = static_cast<uint8_t*>(VSIMalloc(stored.size()));
+                if (*outBuffer == nullptr)
+                    throw GDALException("Cannot allocate tile buffer");
+                std::memcpy(*outBuffer, stored.data(), stored.size());
+                if (outBufferSize != nullptr)
+                    *outBufferSize = static_cast<int>(stored.size());
+                return "";
             }
         }
-        else {
-            std::cout << "Directory already exists: " << dirPath << "\n";
-        }
-
 
         if (tms) {
             ty = tmsToXYZ(ty, tz);
@@ -373,166 +651,1445 @@ namespace ddb
         if (!tMinMax.contains(tx, ty))
             throw GDALException("Out of bounds");
 
-        // Create in-memory dataset for the tile
-        int cappedBands = std::min(3, nBands);
-        GDALDatasetH dsTile = GDALCreate(memDrv, "", tileSize, tileSize, cappedBands + 1, GDT_Byte, nullptr);
-        if (dsTile == nullptr)
-            throw GDALException("Cannot create dsTile");
+        TileCanvas& canvas = scratchCanvas();
+        {
+            const DatasetPool::Lease lease = handles->acquire();
+            if (!renderTile(*lease, tz, tx, ty, canvas))
+                throw GDALException("Geoquery out of bounds");
+        }
+
+        if (skipEmptyTiles && isEmpty(canvas))
+        {
+            if (!writeToMemory)
+                return "";
+
+            const std::vector<uint8_t>& empty = getEmptyTile();
+            *outBuffer = static_cast<uint8_t*>(VSIMalloc(empty.size()));
+            if (*outBuffer == nullptr)
+                throw GDALException("Cannot allocate tile buffer");
+            std::memcpy(*outBuffer, empty.data(), empty.size());
+            if (outBufferSize != nullptr)
+                *outBufferSize = static_cast<int>(empty.size());
+            return "";
+        }
 
-        // Get tile bounds in projected coordinates
-        BoundingBox<Projected2D> b = mercator.tileBounds(tx, ty, tz);
+        if (!cache)
+        {
+            if (!writeToMemory)
+                return storeTile(canvas, tz, tx, outY);
 
-        // Query the source dataset
-        GQResult g = geoQuery(inputDataset, b.min.x, b.max.y, b.max.x, b.min.y, tileSize);
+            encodeTile(canvas, outBuffer, outBufferSize);
+            metrics.addTile();
+            return "";
+        }
 
-        std::cout << "GeoQuery: " << g.r.x << "," << g.r.y << "|" << g.r.xsize << "x"
-            << g.r.ysize << "|" << g.w.x << "," << g.w.y << "|" << g.w.xsize << "x"
-            << g.w.ysize << std::endl;
+        // Encode once in memory so the same bytes feed the cache and the output
+        uint8_t* encoded = nullptr;
+        int encodedSize = 0;
+        encodeTile(canvas, &encoded, &encodedSize);
+        cache->put(cacheKey, encoded, static_cast<size_t>(encodedSize));
 
-        // Only process if we have valid data
-        if (g.r.xsize != 0 && g.r.ysize != 0 && g.w.xsize != 0 && g.w.ysize != 0)
+        if (writeToMemory)
         {
-            const GDALDataType type =
-                GDALGetRasterDataType(GDALGetRasterBand(inputDataset, 1));
+            metrics.addTile();
+            *outBuffer = encoded;
+            if (outBufferSize != nullptr)
+                *outBufferSize = encodedSize;
+            return "";
+        }
 
-            const size_t wSize = g.w.xsize * g.w.ysize;
-            std::unique_ptr<uint8_t[]> buffer(
-                new uint8_t[GDALGetDataTypeSizeBytes(type) * cappedBands * wSize]);
+        std::string location;
+        try
+        {
+            location = writeToSink(tz, tx, outY, encoded, static_cast<size_t>(encodedSize));
+        }
+        catch (...)
+        {
+            VSIFree(encoded);
+            throw;
+        }
+        VSIFree(encoded);
 
-            if (GDALDatasetRasterIO(inputDataset, GF_Read, g.r.x, g.r.y, g.r.xsize,
-                g.r.ysize, buffer.get(), g.w.xsize, g.w.ysize, type,
-                cappedBands, nullptr, 0, 0, 0) != CE_None)
-            {
-                throw GDALException("Cannot read input dataset window");
-            }
+        return location;
+    }
 
-            // Rescale if needed
-            // We currently don't rescale byte datasets
-            // TODO: allow people to specify rescale values
+    std::string GDALTiler::storeTile(const TileCanvas& canvas, int tz, int tx, int ty)
+    {
+        if (skipEmptyTiles && isEmpty(canvas))
+        {
+            if (removeEmptyTiles)
+                sink->remove(tz, tx, ty);
+            return "";
+        }
 
-            if (type != GDT_Byte && type != GDT_Unknown)
-            {
-                std::unique_ptr<uint8_t[]> scaledBuffer(new uint8_t[GDALGetDataTypeSizeBytes(GDT_Byte) * cappedBands * wSize]);
-                size_t bufSize = wSize * cappedBands;
+        // Encoded in memory and handed to the sink, which writes it under a
+        // temporary name and renames it into place, so an interrupted run
+        // never leaves a truncated tile that a resumed seed would take for
+        // a finished one
+        uint8_t* encoded = nullptr;
+        int encodedSize = 0;
+        encodeTile(canvas, &encoded, &encodedSize);
 
-                double globalMin = std::numeric_limits<double>::max(),
-                    globalMax = std::numeric_limits<double>::min();
+        std::string location;
+        try
+        {
+            location = writeToSink(tz, tx, ty, encoded, static_cast<size_t>(encodedSize));
+        }
+        catch (...)
+        {
+            VSIFree(encoded);
+            throw;
+        }
+        VSIFree(encoded);
 
-                for (int i = 0; i < cappedBands; i++)
-                {
-                    double bMin, bMax;
+        return location;
+    }
 
-                    GDALDatasetH ds = origDataset != nullptr ? origDataset : inputDataset; // Use the actual dataset, not the VRT
-                    GDALDatasetH hBand = GDALGetRasterBand(ds, i + 1);
+    std::string GDALTiler::writeToSink(int tz, int tx, int ty, const uint8_t* data, size_t size)
+    {
+        StageTimer timer(metrics, TileStage::Write);
+        std::string location = sink->write(tz, tx, ty, data, size);
+        metrics.addBytesWritten(size);
+        metrics.addTile();
+        return location;
+    }
 
-                    CPLErr statsRes = GDALGetRasterStatistics(hBand, TRUE, FALSE, &bMin, &bMax, nullptr, nullptr);
-                    if (statsRes == CE_Warning)
-                    {
-                        double bMean, bStdDev;
-                        if (GDALGetRasterStatistics(hBand, TRUE, TRUE, &bMin, &bMax, &bMean, &bStdDev) != CE_None)
-                            throw GDALException("Cannot compute band statistics (forced)");
-                        if (GDALSetRasterStatistics(hBand, bMin, bMax, bMean, bStdDev) != CE_None)
-                            throw GDALException("Cannot cache band statistics");
+    void GDALTiler::setForceRender(bool force)
+    {
+        forceRender = force;
+    }
 
-                        std::cout << "Cached band " << i << " statistics (" << bMin << ", " << bMax << ")" << std::endl;
-                    }
-                    else if (statsRes == CE_Failure)
-                    {
-                        throw GDALException("Cannot compute band statistics");
-                    }
+    std::string GDALTiler::renderSettings() const
+    {
+        return "tileSize=" + std::to_string(tileSize) + ";tms=" + std::to_string(tms) +
+               ";format=" + tileExtension + ";zlevel=" + std::to_string(encoder.pngZLevel) +
+               ";quality=" + std::to_string(encoder.quality) + ";lossless=" + std::to_string(encoder.lossless) + "\n";
+    }
 
-                    globalMin = std::min(globalMin, bMin);
-                    globalMax = std::max(globalMax, bMax);
-                }
+    void GDALTiler::syncFreshness()
+    {
+        std::lock_guard<std::mutex> lock(freshMutex);
+        if (freshSink == sink.get())
+            return;
 
-                switch (type)
-                {
-                case GDT_Byte:
-                    rescale<uint8_t>(buffer.get(), scaledBuffer.get(), bufSize, globalMin, globalMax);
-                    break;
-                case GDT_UInt16:
-                    rescale<uint16_t>(buffer.get(), scaledBuffer.get(), bufSize, globalMin, globalMax);
-                    break;
-                case GDT_Int16:
-                    rescale<int16_t>(buffer.get(), scaledBuffer.get(), bufSize, globalMin, globalMax);
-                    break;
-                case GDT_UInt32:
-                    rescale<uint32_t>(buffer.get(), scaledBuffer.get(), bufSize, globalMin, globalMax);
-                    break;
-                case GDT_Int32:
-                    rescale<int32_t>(buffer.get(), scaledBuffer.get(), bufSize, globalMin, globalMax);
-                    break;
-                case GDT_Float32:
-                    rescale<float>(buffer.get(), scaledBuffer.get(), bufSize, globalMin, globalMax);
-                    break;
-                case GDT_Float64:
-                    rescale<double>(buffer.get(), scaledBuffer.get(), bufSize, globalMin, globalMax);
-                    break;
-                default:
-                    break;
-                }
+        freshSince = std::max(sourceTime, sink->settingsTime(renderSettings()));
+        freshSink = sink.get();
+    }
 
-                buffer = std::move(scaledBuffer);
-            }
+    bool GDALTiler::isFresh(int tz, int tx, int ty) const
+    {
+        return !forceRender && sink->isNewerThan(tz, tx, ty, freshSince);
+    }
 
-            const GDALRasterBandH raster = GDALGetRasterBand(inputDataset, 1);
-            GDALRasterBandH alphaBand = FindAlphaBand(inputDataset);
-            if (alphaBand == nullptr)
-                alphaBand = GDALGetMaskBand(raster);
+    void GDALTiler::enableMetrics(bool enabled)
+    {
+        metrics.setEnabled(enabled);
+    }
 
-            std::unique_ptr<uint8_t[]> alphaBuffer(
-                new uint8_t[GDALGetDataTypeSizeBytes(GDT_Byte) * wSize]);
-            if (GDALRasterIO(alphaBand, GF_Read, g.r.x, g.r.y, g.r.xsize, g.r.ysize,
-                alphaBuffer.get(), g.w.xsize, g.w.ysize, GDT_Byte, 0,
-                0) != CE_None)
-            {
-                throw GDALException("Cannot read input dataset alpha window");
-            }
+    TileMetricsReport GDALTiler::getMetrics() const
+    {
+        return metrics.report();
+    }
 
-            // Write data
+    void GDALTiler::resetMetrics()
+    {
+        metrics.reset();
+    }
 
+    void GDALTiler::enableCache(size_t memoryBytes, const std::string& diskPath, size_t diskBytes)
+    {
+        cache.reset(new TileCache(memoryBytes, diskPath, diskBytes));
+        updateCacheSource();
+    }
 
-            if (GDALDatasetRasterIO(dsTile, GF_Write, g.w.x, g.w.y, g.w.xsize,
-                g.w.ysize, buffer.get(), g.w.xsize, g.w.ysize,
-                GDT_Byte, cappedBands, nullptr, 0, 0,
-                0) != CE_None)
-            {
-                throw GDALException("Cannot write tile data");
-            }
+    void GDALTiler::updateCacheSource()
+    {
+        std::error_code ec;
+        const uintmax_t size = fs::file_size(inputPath, ec);
+        cacheSource = Hash::strCRC64(fs::absolute(inputPath).string() + ";size=" + std::to_string(size) +
+                                     ";mtime=" + std::to_string(sourceTime.time_since_epoch().count()) +
+                                     ";" + renderSettings());
+    }
+
+    void GDALTiler::disableCache()
+    {
+        cache.reset();
+    }
+
+    TileCacheStats GDALTiler::getCacheStats() const
+    {
+        return cache ? cache->stats() : TileCacheStats();
+    }
+
+    void GDALTiler::setSkipEmptyTiles(bool skip)
+    {
+        skipEmptyTiles = skip;
+    }
+
+    bool GDALTiler::isEmpty(const TileCanvas& canvas) const
+    {
+        const size_t plane = static_cast<size_t>(canvas.size) * canvas.size;
+        const uint8_t* alpha = canvas.data.data() + (canvas.bands - 1) * plane;
+        return std::all_of(alpha, alpha + plane, [](uint8_t a) { return a == 0; });
+    }
+
+    const std::vector<uint8_t>& GDALTiler::getEmptyTile()
+    {
+        std::lock_guard<std::mutex> lock(emptyTileMutex);
+
+        if (emptyTile.empty())
+        {
+            TileCanvas canvas;
+            initCanvas(canvas);
+
+            uint8_t* encoded = nullptr;
+            int encodedSize = 0;
+            encodeTile(canvas, &encoded, &encodedSize);
+            emptyTile.assign(encoded, encoded + encodedSize);
+            VSIFree(encoded);
+        }
+
+        return emptyTile;
+    }
+
+    void GDALTiler::setEncoder(const TileEncoderOptions& options)
+    {
+        const char* driverName = "PNG";
+        const char* extension = "png";
+        char** createOptions = nullptr;
+
+        switch (options.format)
+        {
+        case TileFormat::PNG:
+            if (options.pngZLevel < 1 || options.pngZLevel > 9)
+                throw GDALException("PNG zlib level must be between 1 and 9");
+            createOptions = CSLSetNameValue(createOptions, "ZLEVEL", std::to_string(options.pngZLevel).c_str());
+            break;
+        case TileFormat::WEBP:
+            driverName = "WEBP";
+            extension = "webp";
+            if (options.quality < 1 || options.quality > 100)
+                throw GDALException("WebP quality must be between 1 and 100");
+            createOptions = CSLSetNameValue(createOptions, "QUALITY", std::to_string(options.quality).c_str());
+            if (options.lossless)
+                createOptions = CSLSetNameValue(createOptions, "LOSSLESS", "YES");
+            break;
+        case TileFormat::JPEG:
+            driverName = "JPEG";
+            extension = "jpg";
+            if (options.quality < 1 || options.quality > 100)
+                throw GDALException("JPEG quality must be between 1 and 100");
+            createOptions = CSLSetNameValue(createOptions, "QUALITY", std::to_string(options.quality).c_str());
+            break;
+        }
+
+        const GDALDriverH drv = options.format == TileFormat::PNG ? pngDrv : GDALGetDriverByName(driverName);
+        if (drv == nullptr)
+        {
+            CSLDestroy(createOptions);
+            throw GDALException(std::string("Cannot create ") + driverName + " driver");
+        }
+
+        CSLDestroy(encoderCreateOptions);
+        encoderCreateOptions = createOptions;
+        encoderDrv = drv;
+        encoder = options;
+        setTileExtension(extension);
+        if (cache)
+            updateCacheSource();
+
+        {
+            std::lock_guard<std::mutex> lock(freshMutex);
+            freshSink = nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(emptyTileMutex);
+        emptyTile.clear();
+    }
+
+    const TileEncoderOptions& GDALTiler::getEncoder() const
+    {
+        return encoder;
+    }
+
+    TileBatchStats GDALTiler::renderBatch(const BoundingBox<Projected2D>& bbox, int minZ, int maxZ, int threads)
+    {
+        if (minZ < 0 || maxZ < minZ)
+            throw GDALException("Invalid zoom range " + std::to_string(minZ) + "-" + std::to_string(maxZ));
+
+        std::vector<TileCoord> tiles;
+        for (int z = minZ; z <= maxZ; z++)
+        {
+            const BoundingBox<Projected2Di> zb = getMinMaxCoordsForZ(z);
+            const Projected2Di a = mercator.metersToTile(bbox.min.x, bbox.min.y, z);
+            const Projected2Di b = mercator.metersToTile(bbox.max.x, bbox.max.y, z);
+
+            for (int x = std::max(a.x, zb.min.x); x <= std::min(b.x, zb.max.x); x++)
+                for (int y = std::max(a.y, zb.min.y); y <= std::min(b.y, zb.max.y); y++)
+                    tiles.push_back({ z, x, tms ? tmsToXYZ(y, z) : y });
+        }
+
+        return renderBatch(tiles, threads);
+    }
+
+    std::vector<TileCoord> GDALTiler::scheduleBatch(const std::vector<TileCoord>& tiles, TileBatchStats& stats)
+    {
+        const DatasetPool::Lease lease = handles->acquire();
+        const TileDatasets& planDs = *lease;
+
+        // Blocks live in the dataset that is actually decoded
+        GDALDatasetH blockDs = planDs.orig != nullptr ? planDs.orig : planDs.input;
+        GDALRasterBandH blockBand = GDALGetRasterBand(blockDs, 1);
+        int blockW = 0, blockH = 0;
+        GDALGetBlockSize(blockBand, &blockW, &blockH);
+        blockW = std::max(1, blockW);
+        blockH = std::max(1, blockH);
+        const int overviews = GDALGetOverviewCount(blockBand);
+
+        // Warped inputs: map VRT pixels onto the source grid by scale only,
+        // close enough for locality
+        const double sx = static_cast<double>(GDALGetRasterXSize(blockDs)) / GDALGetRasterXSize(planDs.input);
+        const double sy = static_cast<double>(GDALGetRasterYSize(blockDs)) / GDALGetRasterYSize(planDs.input);
+
+        struct Planned
+        {
+            TileCoord t;
+            uint64_t order;
+            int level;
+            int bx0, by0, bx1, by1;
+        };
 
-            std::cout << "Wrote tile data" << std::endl;
+        std::map<int, BoundingBox<Projected2Di>> zoomBounds;
+        std::vector<Planned> plan;
+        plan.reserve(tiles.size());
 
-            const GDALRasterBandH tileAlphaBand =
-                GDALGetRasterBand(dsTile, cappedBands + 1);
-            GDALSetRasterColorInterpretation(tileAlphaBand, GCI_AlphaBand);
+        for (const TileCoord& c : tiles)
+        {
+            const int ty = tms ? tmsToXYZ(c.y, c.z) : c.y;
+
+            auto zb = zoomBounds.find(c.z);
+            if (zb == zoomBounds.end())
+                zb = zoomBounds.emplace(c.z, getMinMaxCoordsForZ(c.z)).first;
+            if (!zb->second.contains(c.x, ty))
+                continue;
 
-            if (GDALRasterIO(tileAlphaBand, GF_Write, g.w.x, g.w.y, g.w.xsize,
-                g.w.ysize, alphaBuffer.get(), g.w.xsize, g.w.ysize,
-                GDT_Byte, 0, 0) != CE_None)
+            const BoundingBox<Projected2D> b = mercator.tileBounds(c.x, ty, c.z);
+            const GQResult g = geoQuery(planDs.input, b.min.x, b.max.y, b.max.x, b.min.y, tileSize);
+
+            Planned p{ { c.z, c.x, ty }, 0, 0, 0, 0, -1, -1 };
+            if (g.r.xsize > 0 && g.r.ysize > 0 && g.w.xsize > 0 && g.w.ysize > 0)
             {
-                throw GDALException("Cannot write tile alpha data");
+                // GDAL reads from the overview closest to the downsampling factor
+                const double factor = static_cast<double>(g.r.xsize) / g.w.xsize;
+                while (p.level < overviews && (1 << (p.level + 1)) <= factor)
+                    p.level++;
+
+                const double levelBlockW = static_cast<double>(blockW) * (1 << p.level);
+                const double levelBlockH = static_cast<double>(blockH) * (1 << p.level);
+                p.bx0 = static_cast<int>(g.r.x * sx / levelBlockW);
+                p.by0 = static_cast<int>(g.r.y * sy / levelBlockH);
+                p.bx1 = static_cast<int>((g.r.x + g.r.xsize - 1) * sx / levelBlockW);
+                p.by1 = static_cast<int>((g.r.y + g.r.ysize - 1) * sy / levelBlockH);
+
+                const uint32_t gridSize = static_cast<uint32_t>(std::max(
+                    GDALGetRasterXSize(blockDs) / levelBlockW, GDALGetRasterYSize(blockDs) / levelBlockH)) + 1;
+                p.order = hilbertIndex(hilbertOrder(gridSize),
+                                       static_cast<uint32_t>((p.bx0 + p.bx1) / 2),
+                                       static_cast<uint32_t>((p.by0 + p.by1) / 2));
             }
+            plan.push_back(p);
+        }
+
+        // Cache capacity in blocks of all bands
+        const GDALDataType type = GDALGetRasterDataType(blockBand);
+        const double blockSetBytes = static_cast<double>(blockW) * blockH *
+                                     GDALGetDataTypeSizeBytes(type) * GDALGetRasterCount(blockDs);
+        const size_t capacity = static_cast<size_t>(GDALGetCacheMax64() / blockSetBytes);
+
+        auto simulate = [&](BlockCacheSimulator& sim) {
+            for (const Planned& p : plan)
+                for (int by = p.by0; by <= p.by1; by++)
+                    for (int bx = p.bx0; bx <= p.bx1; bx++)
+                        sim.access(p.level, bx, by);
+        };
+
+        stats.tiles = plan.size();
+
+        BlockCacheSimulator requestOrder(capacity);
+        simulate(requestOrder);
+        if (requestOrder.accesses() > 0)
+            stats.requestOrderHitRate = static_cast<double>(requestOrder.hitCount()) / requestOrder.accesses();
+
+        std::stable_sort(plan.begin(), plan.end(), [](const Planned& a, const Planned& b) {
+            return a.t.z != b.t.z ? a.t.z < b.t.z : a.order < b.order;
+        });
+
+        BlockCacheSimulator scheduled(capacity);
+        simulate(scheduled);
+        stats.blockReads = scheduled.accesses();
+        stats.blockCacheHits = scheduled.hitCount();
+        if (stats.blockReads > 0)
+            stats.blockCacheHitRate = static_cast<double>(stats.blockCacheHits) / stats.blockReads;
+
+        std::vector<TileCoord> tasks;
+        tasks.reserve(plan.size());
+        for (const Planned& p : plan)
+            tasks.push_back(p.t);
+        return tasks;
+    }
+
+    TileBatchStats GDALTiler::renderBatch(const std::vector<TileCoord>& tiles, int threads)
+    {
+        if (threads <= 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
 
-            std::cout << "Wrote tile alpha" << std::endl;
+        syncFreshness();
 
+        const auto start = std::chrono::steady_clock::now();
+
+        // Workers get contiguous runs of the curve
+        TileBatchStats stats;
+        std::vector<TileCoord> tasks = scheduleBatch(tiles, stats);
+
+        if (!forceRender)
+        {
+            const size_t scheduled = tasks.size();
+            tasks.erase(std::remove_if(tasks.begin(), tasks.end(), [this](const TileCoord& t) {
+                return isFresh(t.z, t.x, tms ? tmsToXYZ(t.y, t.z) : t.y);
+            }), tasks.end());
+            stats.skipped = scheduled - tasks.size();
         }
-        else
+
+        if (pipelined)
         {
-            throw GDALException("Geoquery out of bounds");
+            stats.written = runPipeline(tasks, stats);
+            sink->flush();
+            stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            return stats;
         }
 
-        const GDALDatasetH outDs = GDALCreateCopy(pngDrv, tilePath.c_str(), dsTile, FALSE,
-            nullptr, nullptr, nullptr);
-        if (outDs == nullptr)
-            throw GDALException("Cannot create output dataset " + tilePath);
+        std::atomic<size_t> written(0);
+        runOnWorkers(tasks, threads, [&](const TileDatasets& ds, const TileCoord& t) {
+            TileCanvas& canvas = scratchCanvas();
+            if (renderTile(ds, t.z, t.x, t.y, canvas) &&
+                !storeTile(canvas, t.z, t.x, tms ? tmsToXYZ(t.y, t.z) : t.y).empty())
+            {
+                written++;
+            }
+        });
+        sink->flush();
 
-        GDALFlushCache(outDs);
-        GDALClose(outDs);
-        GDALClose(dsTile);
+        stats.written = written;
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
 
+    SeedStats GDALTiler::seed(const SeedOptions& options)
+    {
+        if (options.minZ < 0 || options.maxZ < options.minZ)
+            throw GDALException("Invalid zoom range " + std::to_string(options.minZ) + "-" +
+                                std::to_string(options.maxZ));
+
+        const auto start = std::chrono::steady_clock::now();
 
-        return tilePath;
+        if (options.format != encoder.format)
+        {
+            TileEncoderOptions enc = encoder;
+            enc.format = options.format;
+            setEncoder(enc);
+        }
 
+        // Tile range of each zoom, internal y
+        std::vector<BoundingBox<Projected2Di>> ranges;
+        for (int z = options.minZ; z <= options.maxZ; z++)
+        {
+            const BoundingBox<Projected2Di> zb = getMinMaxCoordsForZ(z);
+            const Projected2Di a = mercator.metersToTile(options.bbox.min.x, options.bbox.min.y, z);
+            const Projected2Di b = mercator.metersToTile(options.bbox.max.x, options.bbox.max.y, z);
+            ranges.emplace_back(Projected2Di(std::max(a.x, zb.min.x), std::max(a.y, zb.min.y)),
+                                Projected2Di(std::min(b.x, zb.max.x), std::min(b.y, zb.max.y)));
+        }
+
+        // Everything that changes which tiles are produced or how they look
+        std::error_code ec;
+        const auto inputSize = fs::file_size(inputPath, ec);
+        std::ostringstream signature;
+        signature << std::setprecision(17)
+                  << "input=" << inputPath << ";size=" << (ec ? 0 : inputSize)
+                  << ";mtime=" << sourceTime.time_since_epoch().count()
+                  << ";output=" << outputPath
+                  << ";bbox=" << options.bbox.min.x << "," << options.bbox.min.y << ","
+                  << options.bbox.max.x << "," << options.bbox.max.y
+                  << ";zoom=" << options.minZ << "-" << options.maxZ
+                  << ";format=" << tileExtension << ";tileSize=" << tileSize << ";tms=" << tms;
+
+        SeedCheckpoint checkpoint(options.minZ, ranges, signature.str());
+        if (!options.checkpointPath.empty() && checkpoint.load(options.checkpointPath))
+        {
+            DDB_LOG(Info) << "Resuming seed from " << options.checkpointPath << ": "
+                          << checkpoint.completed() << "/" << checkpoint.total() << " tiles done";
+        }
+
+        SeedStats stats;
+        stats.total = checkpoint.total();
+        stats.alreadyDone = checkpoint.completed();
+
+        // Row by row, so that consecutive chunks read neighbouring source blocks
+        std::vector<TileCoord> pending;
+        pending.reserve(static_cast<size_t>(stats.total - stats.alreadyDone));
+        for (int z = options.minZ; z <= options.maxZ; z++)
+        {
+            const BoundingBox<Projected2Di>& r = ranges[z - options.minZ];
+            for (int y = r.min.y; y <= r.max.y; y++)
+                for (int x = r.min.x; x <= r.max.x; x++)
+                    if (!checkpoint.isDone(z, x, y))
+                        pending.push_back({ z, x, y });
+        }
+
+        size_t chunk = 256;
+        std::vector<TileCoord> batch;
+        for (size_t pos = 0; pos < pending.size();)
+        {
+            const size_t n = std::min(chunk, pending.size() - pos);
+            batch.clear();
+            for (size_t i = pos; i < pos + n; i++)
+            {
+                const TileCoord& t = pending[i];
+                batch.push_back({ t.z, t.x, tms ? tmsToXYZ(t.y, t.z) : t.y });
+            }
+
+            const TileBatchStats b = renderBatch(batch, options.threads);
+            stats.rendered += n;
+            stats.written += b.written;
+            stats.skipped += b.skipped;
+
+            // renderBatch flushed the sink, every tile of the chunk is stored
+            for (size_t i = pos; i < pos + n; i++)
+                checkpoint.markDone(pending[i].z, pending[i].x, pending[i].y);
+            pos += n;
+
+            if (!options.checkpointPath.empty())
+            {
+                checkpoint.save(options.checkpointPath);
+                stats.checkpoints++;
+            }
+
+            DDB_LOG(Info) << "Seeded " << checkpoint.completed() << "/" << checkpoint.total() << " tiles";
+
+            // Aim the next chunk at checkpointSeconds
+            if (b.seconds > 0.0 && options.checkpointSeconds > 0.0)
+            {
+                const double target = static_cast<double>(n) * options.checkpointSeconds / b.seconds;
+                chunk = static_cast<size_t>(std::max(16.0, std::min(target, 2.0 * static_cast<double>(n) + 16.0)));
+            }
+        }
+
+        stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats;
+    }
+
+    std::vector<TileCoord> GDALTiler::changedTiles(const std::string& manifestPath, int minZ, int maxZ)
+    {
+        SourceFingerprint current;
+        return findChangedTiles(manifestPath, minZ, maxZ, current);
+    }
+
+    TileBatchStats GDALTiler::updateChangedTiles(const std::string& manifestPath, int minZ, int maxZ, int threads)
+    {
+        SourceFingerprint current;
+        const std::vector<TileCoord> tiles = findChangedTiles(manifestPath, minZ, maxZ, current);
+
+        TileBatchStats stats;
+        if (!tiles.empty())
+        {
+            // Encoded tiles of the old content must not be served again
+            if (cache)
+                cache->clear();
+
+            // The fingerprints say these tiles changed, whatever their
+            // timestamps say (an input copied with its old mtime looks older).
+            // Tiles that became empty must not keep their old content.
+            const FlagGuard force(forceRender, true);
+            const FlagGuard removeEmpty(removeEmptyTiles, true);
+            stats = renderBatch(tiles, threads);
+        }
+
+        // Only once every tile made it to the sink
+        current.save(manifestPath);
+
+        return stats;
+    }
+
+    std::vector<TileCoord> GDALTiler::findChangedTiles(const std::string& manifestPath, int minZ, int maxZ,
+                                                       SourceFingerprint& current)
+    {
+        if (minZ < 0 || maxZ < minZ)
+            throw GDALException("Invalid zoom range " + std::to_string(minZ) + "-" + std::to_string(maxZ));
+
+        // The original file, not the warped VRT or the EPSG:3857 cache
+        const std::unique_ptr<void, decltype(&GDALClose)> src(GDALOpen(inputPath.c_str(), GA_ReadOnly), &GDALClose);
+        if (!src)
+            throw GDALException("Cannot open " + inputPath);
+
+        current = SourceFingerprint::compute(src.get());
+        const SourceFingerprint previous = SourceFingerprint::load(manifestPath);
+
+        std::vector<BoundingBox<Projected2Di>> zoomBounds;
+        for (int z = minZ; z <= maxZ; z++)
+            zoomBounds.push_back(getMinMaxCoordsForZ(z));
+
+        std::vector<TileCoord> tiles;
+
+        if (previous.empty() || !current.sameLayout(previous))
+        {
+            for (int z = minZ; z <= maxZ; z++)
+            {
+                const BoundingBox<Projected2Di>& zb = zoomBounds[z - minZ];
+                for (int x = zb.min.x; x <= zb.max.x; x++)
+                    for (int y = zb.min.y; y <= zb.max.y; y++)
+                        tiles.push_back({ z, x, tms ? tmsToXYZ(y, z) : y });
+            }
+            return tiles;
+        }
+
+        const std::vector<std::pair<int, int>> blocks = current.changedBlocks(previous);
+        if (blocks.empty())
+            return tiles;
+
+        // Block footprints are projected to EPSG:3857
+        const OGRSpatialReferenceH srcSrs = OSRNewSpatialReference(nullptr);
+        const OGRSpatialReferenceH mercatorSrs = OSRNewSpatialReference(nullptr);
+        OGRCoordinateTransformationH ct = nullptr;
+        {
+            char* wkt = const_cast<char*>(GDALGetProjectionRef(src.get()));
+            const bool hasSrs = wkt != nullptr && OSRImportFromWkt(srcSrs, &wkt) == OGRERR_NONE;
+            OSRImportFromEPSG(mercatorSrs, 3857);
+            OSRSetAxisMappingStrategy(srcSrs, OAMS_TRADITIONAL_GIS_ORDER);
+            OSRSetAxisMappingStrategy(mercatorSrs, OAMS_TRADITIONAL_GIS_ORDER);
+
+            const bool same = hasSrs && sameProjection(srcSrs, mercatorSrs);
+            if (hasSrs && !same)
+                ct = OCTNewCoordinateTransformation(srcSrs, mercatorSrs);
+            OSRDestroySpatialReference(srcSrs);
+            OSRDestroySpatialReference(mercatorSrs);
+
+            if (!hasSrs || (!same && ct == nullptr))
+                throw GDALException("Cannot project the blocks of " + inputPath + " to EPSG:3857");
+        }
+
+        double gt[6];
+        GDALGetGeoTransform(src.get(), gt);
+        const int rasterW = GDALGetRasterXSize(src.get());
+        const int rasterH = GDALGetRasterYSize(src.get());
+
+        std::unordered_set<uint64_t> seen;
+
+        // Changed blocks come row-major, consecutive ones of a row are
+        // projected together
+        for (size_t i = 0; i < blocks.size();)
+        {
+            size_t j = i + 1;
+            while (j < blocks.size() && blocks[j].second == blocks[i].second &&
+                   blocks[j].first == blocks[j - 1].first + 1)
+            {
+                j++;
+            }
+
+            // One extra source pixel around the run for resampling
+            const int px0 = std::max(0, blocks[i].first * current.getBlockWidth() - 1);
+            const int px1 = std::min(rasterW, (blocks[j - 1].first + 1) * current.getBlockWidth() + 1);
+            const int py0 = std::max(0, blocks[i].second * current.getBlockHeight() - 1);
+            const int py1 = std::min(rasterH, (blocks[i].second + 1) * current.getBlockHeight() + 1);
+            i = j;
+
+            double minX = std::numeric_limits<double>::max(), minY = minX;
+            double maxX = std::numeric_limits<double>::lowest(), maxY = maxX;
+            for (const int px : { px0, px1 })
+            {
+                for (const int py : { py0, py1 })
+                {
+                    const double gx = gt[0] + px * gt[1] + py * gt[2];
+                    const double gy = gt[3] + px * gt[4] + py * gt[5];
+                    minX = std::min(minX, gx);
+                    maxX = std::max(maxX, gx);
+                    minY = std::min(minY, gy);
+                    maxY = std::max(maxY, gy);
+                }
+            }
+
+            if (ct != nullptr &&
+                !OCTTransformBounds(ct, minX, minY, maxX, maxY, &minX, &minY, &maxX, &maxY, 21))
+            {
+                OCTDestroyCoordinateTransformation(ct);
+                throw GDALException("Cannot project a changed block of " + inputPath + " to EPSG:3857");
+            }
+
+            for (int z = minZ; z <= maxZ; z++)
+            {
+                const BoundingBox<Projected2Di>& zb = zoomBounds[z - minZ];
+                const Projected2Di a = mercator.metersToTile(minX, minY, z);
+                const Projected2Di b = mercator.metersToTile(maxX, maxY, z);
+
+                for (int x = std::max(a.x, zb.min.x); x <= std::min(b.x, zb.max.x); x++)
+                {
+                    for (int y = std::max(a.y, zb.min.y); y <= std::min(b.y, zb.max.y); y++)
+                    {
+                        const uint64_t key = (static_cast<uint64_t>(z) << 58) |
+                                             (static_cast<uint64_t>(x) << 29) | static_cast<uint64_t>(y);
+                        if (seen.insert(key).second)
+                            tiles.push_back({ z, x, tms ? tmsToXYZ(y, z) : y });
+                    }
+                }
+            }
+        }
+
+        if (ct != nullptr)
+            OCTDestroyCoordinateTransformation(ct);
+
+        return tiles;
+    }
+
+    void GDALTiler::enablePipeline(const TilePipelineOptions& options)
+    {
+        if (options.readers < 1 || options.encoders < 0 || options.writers < 1)
+            throw GDALException("Invalid pipeline thread counts");
+
+        pipelineOptions = options;
+        if (pipelineOptions.encoders == 0)
+            pipelineOptions.encoders = std::max(1u, std::thread::hardware_concurrency());
+        pipelined = true;
+    }
+
+    void GDALTiler::disablePipeline()
+    {
+        pipelined = false;
+    }
+
+    size_t GDALTiler::runPipeline(const std::vector<TileCoord>& tasks, TileBatchStats& stats)
+    {
+        using Clock = std::chrono::steady_clock;
+        const TilePipelineOptions& o = pipelineOptions;
+
+        struct Rendered
+        {
+            TileCoord t;
+            TileCanvas* canvas;
+        };
+
+        struct Encoded
+        {
+            TileCoord t;
+            std::unique_ptr<uint8_t, decltype(&VSIFree)> data{ nullptr, &VSIFree };
+            int size = 0;
+
+            // Empty tile to delete from the sink, see removeEmptyTiles
+            bool remove = false;
+        };
+
+        struct Stage
+        {
+            std::atomic<uint64_t> busyNs{ 0 };
+            std::atomic<uint64_t> waitNs{ 0 };
+            std::atomic<size_t> items{ 0 };
+        };
+
+        auto elapsedNs = [](Clock::time_point since) {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count());
+        };
+
+        // Canvases circulate between readers and encoders, so their number
+        // caps the tiles in flight and nothing is allocated per tile
+        std::vector<TileCanvas> canvases(o.queueDepth + o.readers + o.encoders);
+        BoundedQueue<TileCanvas*> freeCanvases(canvases.size());
+        for (auto& c : canvases)
+            freeCanvases.push(&c);
+
+        BoundedQueue<Rendered> rendered(o.queueDepth);
+        BoundedQueue<Encoded> encoded(o.queueDepth);
+
+        Stage readStage, encodeStage, writeStage;
+        std::atomic<size_t> next(0);
+        std::atomic<size_t> written(0);
+        std::atomic<int> readersLeft(o.readers), encodersLeft(o.encoders);
+
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        auto fail = [&](std::exception_ptr e) {
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = e;
+            }
+            freeCanvases.close();
+            rendered.close();
+            encoded.close();
+        };
+
+        auto reader = [&]() {
+            const FlagGuard worker(onWorker, true);
+            try
+            {
+                for (size_t i = next++; i < tasks.size(); i = next++)
+                {
+                    const TileCoord& t = tasks[i];
+
+                    auto waitStart = Clock::now();
+                    TileCanvas* canvas = nullptr;
+                    if (!freeCanvases.pop(canvas))
+                        break;
+                    readStage.waitNs += elapsedNs(waitStart);
+
+                    const auto busyStart = Clock::now();
+                    bool hasTile;
+                    {
+                        const DatasetPool::Lease lease = handles->acquire();
+                        hasTile = renderTile(*lease, t.z, t.x, t.y, *canvas);
+                    }
+                    readStage.busyNs += elapsedNs(busyStart);
+                    readStage.items++;
+
+                    waitStart = Clock::now();
+                    const bool pushed = hasTile ? rendered.push({ t, canvas }) : freeCanvases.push(canvas);
+                    readStage.waitNs += elapsedNs(waitStart);
+                    if (!pushed)
+                        break;
+                }
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+            }
+
+            if (--readersLeft == 0)
+                rendered.close();
+        };
+
+        auto encoder = [&]() {
+            try
+            {
+                Rendered r;
+                for (;;)
+                {
+                    auto waitStart = Clock::now();
+                    if (!rendered.pop(r))
+                        break;
+                    encodeStage.waitNs += elapsedNs(waitStart);
+
+                    const auto busyStart = Clock::now();
+                    Encoded e;
+                    e.t = r.t;
+                    const bool skip = skipEmptyTiles && isEmpty(*r.canvas);
+                    e.remove = skip && removeEmptyTiles;
+                    if (!skip)
+                    {
+                        uint8_t* buf = nullptr;
+                        encodeTile(*r.canvas, &buf, &e.size);
+                        e.data.reset(buf);
+                    }
+                    encodeStage.busyNs += elapsedNs(busyStart);
+                    encodeStage.items++;
+
+                    waitStart = Clock::now();
+                    freeCanvases.push(r.canvas);
+                    const bool pushed = (skip && !e.remove) || encoded.push(std::move(e));
+                    encodeStage.waitNs += elapsedNs(waitStart);
+                    if (!pushed)
+                        break;
+                }
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+            }
+
+            if (--encodersLeft == 0)
+                encoded.close();
+        };
+
+        auto writer = [&]() {
+            try
+            {
+                Encoded e;
+                for (;;)
+                {
+                    const auto waitStart = Clock::now();
+                    if (!encoded.pop(e))
+                        break;
+                    writeStage.waitNs += elapsedNs(waitStart);
+
+                    const auto busyStart = Clock::now();
+                    const int outY = tms ? tmsToXYZ(e.t.y, e.t.z) : e.t.y;
+                    if (e.remove)
+                    {
+                        sink->remove(e.t.z, e.t.x, outY);
+                    }
+                    else
+                    {
+                        writeToSink(e.t.z, e.t.x, outY, e.data.get(), static_cast<size_t>(e.size));
+                        e.data.reset();
+                        written++;
+                    }
+                    writeStage.busyNs += elapsedNs(busyStart);
+                    writeStage.items++;
+                }
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+            }
+        };
+
+        const auto start = Clock::now();
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < o.readers; i++)
+            threads.emplace_back(reader);
+        for (int i = 0; i < o.encoders; i++)
+            threads.emplace_back(encoder);
+        for (int i = 0; i < o.writers; i++)
+            threads.emplace_back(writer);
+        for (auto& t : threads)
+            t.join();
+
+        if (error)
+            std::rethrow_exception(error);
+
+        const double wall = std::chrono::duration<double>(Clock::now() - start).count();
+        auto report = [wall](const char* name, int workers, const Stage& s, size_t depth) {
+            TileStageStats r;
+            r.name = name;
+            r.workers = workers;
+            r.items = s.items;
+            r.busySeconds = s.busyNs / 1e9;
+            r.waitSeconds = s.waitNs / 1e9;
+            r.occupancy = wall > 0.0 ? r.busySeconds / (workers * wall) : 0.0;
+            r.maxQueueDepth = depth;
+            return r;
+        };
+
+        stats.stages.push_back(report("read", o.readers, readStage, 0));
+        stats.stages.push_back(report("encode", o.encoders, encodeStage, rendered.maxDepth()));
+        stats.stages.push_back(report("write", o.writers, writeStage, encoded.maxDepth()));
+
+        return written;
+    }
+
+    size_t GDALTiler::buildPyramid(int minZ, int maxZ, int threads, bool fromChildren)
+    {
+        if (minZ < 0 || maxZ < minZ)
+            throw GDALException("Invalid zoom range " + std::to_string(minZ) + "-" + std::to_string(maxZ));
+
+        if (threads <= 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        syncFreshness();
+
+        std::vector<BoundingBox<Projected2Di>> bounds(maxZ + 1);
+        for (int z = minZ; z <= maxZ; z++)
+            bounds[z] = getMinMaxCoordsForZ(z);
+
+        std::atomic<size_t> written(0);
+
+        if (!fromChildren && metatileSize > 1)
+        {
+            // One task per metatile, aligned to multiples of metatileSize
+            std::vector<TileCoord> tasks;
+            for (int z = minZ; z <= maxZ; z++)
+                for (int mx = floorDiv(bounds[z].min.x, metatileSize); mx <= floorDiv(bounds[z].max.x, metatileSize); mx++)
+                    for (int my = floorDiv(bounds[z].min.y, metatileSize); my <= floorDiv(bounds[z].max.y, metatileSize); my++)
+                        tasks.push_back({ z, mx * metatileSize, my * metatileSize });
+
+            runOnWorkers(tasks, threads, [&](const TileDatasets& ds, const TileCoord& t) {
+                written += renderMetatile(ds, bounds[t.z], t.z, t.x, t.y);
+            });
+
+            sink->flush();
+            return written;
+        }
+
+        if (!fromChildren)
+        {
+            std::vector<TileCoord> tasks;
+            for (int z = minZ; z <= maxZ; z++)
+                for (int x = bounds[z].min.x; x <= bounds[z].max.x; x++)
+                    for (int y = bounds[z].min.y; y <= bounds[z].max.y; y++)
+                        tasks.push_back({ z, x, y });
+
+            runOnWorkers(tasks, threads, [&](const TileDatasets& ds, const TileCoord& t) {
+                const int outY = tms ? tmsToXYZ(t.y, t.z) : t.y;
+                if (isFresh(t.z, t.x, outY))
+                    return;
+
+                TileCanvas& canvas = scratchCanvas();
+                if (renderTile(ds, t.z, t.x, t.y, canvas) && !storeTile(canvas, t.z, t.x, outY).empty())
+                    written++;
+            });
+
+            sink->flush();
+            return written;
+        }
+
+        // Pick the first zoom with enough tiles to keep every worker busy.
+        // Each of its tiles is a task that builds its whole subtree down to
+        // maxZ depth-first, so only a few canvases per level are alive at once.
+        int rootZ = minZ;
+        while (rootZ < maxZ)
+        {
+            const size_t count = static_cast<size_t>(bounds[rootZ].max.x - bounds[rootZ].min.x + 1) *
+                static_cast<size_t>(bounds[rootZ].max.y - bounds[rootZ].min.y + 1);
+            if (count >= static_cast<size_t>(threads) * 4)
+                break;
+            rootZ++;
+        }
+
+        std::vector<TileCoord> tasks;
+        for (int x = bounds[rootZ].min.x; x <= bounds[rootZ].max.x; x++)
+            for (int y = bounds[rootZ].min.y; y <= bounds[rootZ].max.y; y++)
+                tasks.push_back({ rootZ, x, y });
+
+        std::map<std::pair<int, int>, TileCanvas> level;
+        std::mutex levelMutex;
+
+        runOnWorkers(tasks, threads, [&](const TileDatasets& ds, const TileCoord& t) {
+            TileCanvas canvas;
+            written += buildFromChildren(ds, bounds, maxZ, t.z, t.x, t.y, canvas);
+            if (canvas.hasData)
+            {
+                std::lock_guard<std::mutex> lock(levelMutex);
+                level[{ t.x, t.y }] = std::move(canvas);
+            }
+        });
+
+        // The few tiles above the root level are reduced from the canvases kept in memory
+        for (int z = rootZ - 1; z >= minZ; z--)
+        {
+            std::map<std::pair<int, int>, TileCanvas> parents;
+            for (int x = bounds[z].min.x; x <= bounds[z].max.x; x++)
+            {
+                for (int y = bounds[z].min.y; y <= bounds[z].max.y; y++)
+                {
+                    TileCanvas canvas;
+                    initCanvas(canvas);
+                    for (int c = 0; c < 4; c++)
+                    {
+                        const int cx = 2 * x + (c & 1), cy = 2 * y + (c >> 1);
+                        auto it = level.find({ cx, cy });
+                        if (it != level.end())
+                            reduceChild(it->second, canvas, c & 1, c >> 1);
+                    }
+
+                    if (canvas.hasData)
+                    {
+                        if (!storeTile(canvas, z, x, tms ? tmsToXYZ(y, z) : y).empty())
+                            written++;
+                        parents[{ x, y }] = std::move(canvas);
+                    }
+                }
+            }
+            level = std::move(parents);
+        }
+
+        sink->flush();
+        return written;
+    }
+
+    size_t GDALTiler::buildFromChildren(const TileDatasets& ds,
+                                        const std::vector<BoundingBox<Projected2Di>>& bounds,
+                                        int maxZ, int tz, int tx, int ty, TileCanvas& canvas)
+    {
+        size_t written = 0;
+
+        if (tz == maxZ)
+        {
+            if (!renderTile(ds, tz, tx, ty, canvas))
+                return 0;
+        }
+        else
+        {
+            initCanvas(canvas);
+
+            BoundingBox<Projected2Di> childBounds = bounds[tz + 1];
+            for (int c = 0; c < 4; c++)
+            {
+                const int cx = 2 * tx + (c & 1), cy = 2 * ty + (c >> 1);
+                if (!childBounds.contains(cx, cy))
+                    continue;
+
+                TileCanvas child;
+                written += buildFromChildren(ds, bounds, maxZ, tz + 1, cx, cy, child);
+                if (child.hasData)
+                    reduceChild(child, canvas, c & 1, c >> 1);
+            }
+
+            if (!canvas.hasData)
+                return written;
+        }
+
+        if (storeTile(canvas, tz, tx, tms ? tmsToXYZ(ty, tz) : ty).empty())
+            return written;
+        return written + 1;
+    }
+
+    void GDALTiler::runOnWorkers(const std::vector<TileCoord>& tasks, int threads,
+                                 const std::function<void(const TileDatasets&, const TileCoord&)>& fn)
+    {
+        WorkStealingPool<TileCoord> pool(threads);
+
+        // Handles are checked out per task, so workers never hold one while
+        // waiting for another and can share the pool with tile() callers.
+        // The pool returns the most recently used set, usually the worker's own.
+        pool.run(tasks, [&](int, const TileCoord& t) {
+            const FlagGuard worker(onWorker, true);
+            const DatasetPool::Lease lease = handles->acquire();
+            fn(*lease, t);
+        });
+    }
+
+    void GDALTiler::initCanvas(TileCanvas& canvas, int tiles)
+    {
+        canvas.size = tileSize * tiles;
+        canvas.bands = std::min(3, nBands) + 1;
+        canvas.hasData = false;
+        canvas.data.assign(static_cast<size_t>(canvas.bands) * canvas.size * canvas.size, 0);
+    }
+
+    void GDALTiler::setMetatileSize(int tiles)
+    {
+        if (tiles < 1)
+            throw GDALException("Metatile size must be at least 1");
+        metatileSize = tiles;
+    }
+
+    size_t GDALTiler::renderMetatile(const TileDatasets& ds, BoundingBox<Projected2Di> bounds,
+                                     int tz, int tx, int ty)
+    {
+        const int n = metatileSize;
+        size_t written = 0;
+
+        // Tiles to produce, nothing to read when every tile is up to date
+        std::vector<char> wanted(static_cast<size_t>(n) * n);
+        bool any = false;
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                const int x = tx + i, y = ty + j;
+                wanted[i * n + j] = bounds.contains(x, y) && !isFresh(tz, x, tms ? tmsToXYZ(y, tz) : y);
+                any = any || wanted[i * n + j];
+            }
+        }
+        if (!any)
+            return 0;
+
+        // Warped tiles are produced one by one by the warper
+        if (ds.warper)
+        {
+            for (int x = tx; x < tx + n; x++)
+            {
+                for (int y = ty; y < ty + n; y++)
+                {
+                    TileCanvas& canvas = scratchCanvas();
+                    if (wanted[(x - tx) * n + (y - ty)] && renderTile(ds, tz, x, y, canvas) &&
+                        !storeTile(canvas, tz, x, tms ? tmsToXYZ(y, tz) : y).empty())
+                    {
+                        written++;
+                    }
+                }
+            }
+            return written;
+        }
+
+        TileCanvas& meta = scratchMetatile();
+        GeoExtent window;
+        if (!renderRegion(ds, tz, tx, ty, n, meta, window))
+            return 0;
+
+        TileCanvas& canvas = scratchCanvas();
+        initCanvas(canvas);
+        const size_t plane = static_cast<size_t>(tileSize) * tileSize;
+        const size_t metaPlane = static_cast<size_t>(meta.size) * meta.size;
+
+        for (int i = 0; i < n; i++)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                const int x = tx + i, y = ty + j;
+                if (!wanted[i * n + j])
+                    continue;
+
+                // Image rows grow southwards, the highest y is at the top
+                const int x0 = i * tileSize;
+                const int y0 = (n - 1 - j) * tileSize;
+
+                // Same rule as a single tile: skip tiles the raster does not reach
+                if (x0 >= window.x + window.xsize || x0 + tileSize <= window.x ||
+                    y0 >= window.y + window.ysize || y0 + tileSize <= window.y)
+                {
+                    continue;
+                }
+
+                for (int band = 0; band < canvas.bands; band++)
+                {
+                    const uint8_t* src = meta.data.data() + band * metaPlane;
+                    uint8_t* dst = canvas.data.data() + band * plane;
+                    for (int row = 0; row < tileSize; row++)
+                    {
+                        std::memcpy(dst + static_cast<size_t>(row) * tileSize,
+                                    src + static_cast<size_t>(y0 + row) * meta.size + x0, tileSize);
+                    }
+                }
+                canvas.hasData = true;
+
+                if (!storeTile(canvas, tz, x, tms ? tmsToXYZ(y, tz) : y).empty())
+                    written++;
+            }
+        }
+
+        return written;
+    }
+
+    void GDALTiler::reduceChild(const TileCanvas& child, TileCanvas& parent, int qx, int qy)
+    {
+        // Internal y grows northwards while image rows grow southwards,
+        // so the child with the higher y fills the top half
+        const int half = parent.size / 2;
+        const int offX = qx * half;
+        const int offY = (1 - qy) * half;
+        const size_t plane = static_cast<size_t>(parent.size) * parent.size;
+        const int colorBands = parent.bands - 1;
+
+        const uint8_t* alpha = child.data.data() + colorBands * plane;
+        uint8_t* dstAlpha = parent.data.data() + colorBands * plane;
+
+        for (int y = 0; y < half; y++)
+        {
+            for (int x = 0; x < half; x++)
+            {
+                const size_t s0 = static_cast<size_t>(2 * y) * child.size + 2 * x;
+                const size_t s1 = s0 + child.size;
+                const size_t d = static_cast<size_t>(offY + y) * parent.size + offX + x;
+
+                const int a[4] = { alpha[s0], alpha[s0 + 1], alpha[s1], alpha[s1 + 1] };
+                const int aSum = a[0] + a[1] + a[2] + a[3];
+                dstAlpha[d] = static_cast<uint8_t>((aSum + 2) / 4);
+                if (aSum == 0)
+                    continue;
+
+                // Weight colors by alpha so transparent pixels don't darken edges
+                for (int b = 0; b < colorBands; b++)
+                {
+                    const uint8_t* src = child.data.data() + b * plane;
+                    const int sum = src[s0] * a[0] + src[s0 + 1] * a[1] +
+                                    src[s1] * a[2] + src[s1 + 1] * a[3];
+                    parent.data[b * plane + d] = static_cast<uint8_t>((sum + aSum / 2) / aSum);
+                }
+            }
+        }
+
+        parent.hasData = true;
+    }
+
+    bool GDALTiler::renderTile(const TileDatasets& ds, int tz, int tx, int ty, TileCanvas& canvas)
+    {
+        GeoExtent window;
+        return renderRegion(ds, tz, tx, ty, 1, canvas, window);
+    }
+
+    bool GDALTiler::renderRegion(const TileDatasets& ds, int tz, int tx, int ty, int tiles,
+                                 TileCanvas& canvas, GeoExtent& window)
+    {
+        int cappedBands = std::min(3, nBands);
+        const int size = tileSize * tiles;
+
+        // Get region bounds in projected coordinates
+        BoundingBox<Projected2D> b(mercator.tileBounds(tx, ty, tz).min,
+                                   mercator.tileBounds(tx + tiles - 1, ty + tiles - 1, tz).max);
+
+        // Query the source dataset
+        GQResult g;
+        {
+            StageTimer timer(metrics, TileStage::GeoQuery);
+            g = geoQuery(ds.input, b.min.x, b.max.y, b.max.x, b.min.y, size);
+        }
+
+        DDB_LOG(Debug) << "GeoQuery: " << g.r.x << "," << g.r.y << "|" << g.r.xsize << "x"
+            << g.r.ysize << "|" << g.w.x << "," << g.w.y << "|" << g.w.xsize << "x"
+            << g.w.ysize;
+
+        // Only process if we have valid data. Windows entirely outside the
+        // raster end up with negative sizes.
+        if (g.r.xsize <= 0 || g.r.ysize <= 0 || g.w.xsize <= 0 || g.w.ysize <= 0)
+            return false;
+
+        StageTimer readTimer(metrics, TileStage::SourceRead);
+
+        GDALDatasetH readDs = ds.input;
+        if (ds.warper && tiles == 1)
+        {
+            // Warp the whole tile and read it back as is
+            const double res = (b.max.x - b.min.x) / tileSize;
+            const double gt[6] = { b.min.x, res, 0.0, b.max.y, 0.0, -res };
+            readDs = ds.warper->warp(tz, gt, onWorker);
+
+            g.r = { 0, 0, tileSize, tileSize };
+            g.w = g.r;
+        }
+
+        const GDALDataType type =
+            GDALGetRasterDataType(GDALGetRasterBand(readDs, 1));
+
+        TileArena& arena = TileArena::local();
+
+        // Clipped to the raster and the canvas, so both windows fit GDAL's int
+        // arguments; only the byte counts need 64 bits
+        const int rx = static_cast<int>(g.r.x), ry = static_cast<int>(g.r.y);
+        const int rxsize = static_cast<int>(g.r.xsize), rysize = static_cast<int>(g.r.ysize);
+        const int wxsize = static_cast<int>(g.w.xsize), wysize = static_cast<int>(g.w.ysize);
+
+        const size_t wSize = static_cast<size_t>(wxsize) * static_cast<size_t>(wysize);
+        const size_t typeSize = static_cast<size_t>(GDALGetDataTypeSizeBytes(type));
+        uint8_t* buffer = arena.buffer(TileArena::ReadBuffer, typeSize * cappedBands * wSize);
+
+        if (GDALDatasetRasterIO(readDs, GF_Read, rx, ry, rxsize,
+            rysize, buffer, wxsize, wysize, type,
+            cappedBands, nullptr, 0, 0, 0) != CE_None)
+        {
+            throw GDALException("Cannot read input dataset window");
+        }
+        readTimer.stop();
+        metrics.addBytesRead(typeSize * cappedBands * wSize);
+
+        // Rescale if needed
+        // We currently don't rescale byte datasets
+        // TODO: allow people to specify rescale values
+
+        if (type != GDT_Byte && type != GDT_Unknown)
+        {
+            if (!hasStatistics)
+                throw GDALException("Band statistics are not available");
+
+            StageTimer timer(metrics, TileStage::Rescale);
+
+            uint8_t* scaledBuffer = arena.buffer(TileArena::ScaledBuffer, cappedBands * wSize);
+            size_t bufSize = wSize * cappedBands;
+
+            switch (type)
+            {
+            case GDT_Byte:
+                rescale<uint8_t>(buffer, scaledBuffer, bufSize, globalMin, globalMax);
+                break;
+            case GDT_UInt16:
+                rescale<uint16_t>(buffer, scaledBuffer, bufSize, globalMin, globalMax);
+                break;
+            case GDT_Int16:
+                rescale<int16_t>(buffer, scaledBuffer, bufSize, globalMin, globalMax);
+                break;
+            case GDT_UInt32:
+                rescale<uint32_t>(buffer, scaledBuffer, bufSize, globalMin, globalMax);
+                break;
+            case GDT_Int32:
+                rescale<int32_t>(buffer, scaledBuffer, bufSize, globalMin, globalMax);
+                break;
+            case GDT_Float32:
+                rescale<float>(buffer, scaledBuffer, bufSize, globalMin, globalMax);
+                break;
+            case GDT_Float64:
+                rescale<double>(buffer, scaledBuffer, bufSize, globalMin, globalMax);
+                break;
+            default:
+                break;
+            }
+
+            buffer = scaledBuffer;
+        }
+
+        StageTimer alphaTimer(metrics, TileStage::AlphaRead);
+
+        const GDALRasterBandH raster = GDALGetRasterBand(readDs, 1);
+        GDALRasterBandH alphaBand = FindAlphaBand(readDs);
+        if (alphaBand == nullptr)
+            alphaBand = GDALGetMaskBand(raster);
+
+        uint8_t* alphaBuffer = arena.buffer(TileArena::AlphaBuffer, wSize);
+        if (GDALRasterIO(alphaBand, GF_Read, rx, ry, rxsize, rysize,
+            alphaBuffer, wxsize, wysize, GDT_Byte, 0,
+            0) != CE_None)
+        {
+            throw GDALException("Cannot read input dataset alpha window");
+        }
+        alphaTimer.stop();
+        metrics.addBytesRead(wSize);
+
+        // Place the window into the tile canvas, alpha goes last
+        initCanvas(canvas, tiles);
+        const size_t plane = static_cast<size_t>(size) * size;
+        for (int band = 0; band <= cappedBands; band++)
+        {
+            const uint8_t* src = band < cappedBands ? buffer + band * wSize : alphaBuffer;
+            uint8_t* dst = canvas.data.data() + band * plane;
+            for (int row = 0; row < wysize; row++)
+            {
+                std::memcpy(dst + static_cast<size_t>(g.w.y + row) * size + static_cast<size_t>(g.w.x),
+                            src + static_cast<size_t>(row) * wxsize, static_cast<size_t>(wxsize));
+            }
+        }
+        canvas.hasData = true;
+        window = g.w;
+
+        return true;
+    }
+
+    void GDALTiler::writeTile(const TileCanvas& canvas, const std::string& tilePath)
+    {
+        StageTimer timer(metrics, TileStage::Encode);
+
+        // Create in-memory dataset for the tile
+        const int cappedBands = canvas.bands - 1;
+
+        // JPEG cannot store alpha, only the color planes are encoded
+        const bool withAlpha = encoder.format != TileFormat::JPEG;
+        const int outBands = withAlpha ? canvas.bands : cappedBands;
+
+        // Owned by the thread's arena and reused for every tile of this shape
+        GDALDatasetH dsTile = TileArena::local().canvasDataset(memDrv, canvas.size, outBands, withAlpha);
+
+        if (GDALDatasetRasterIO(dsTile, GF_Write, 0, 0, canvas.size, canvas.size,
+            const_cast<uint8_t*>(canvas.data.data()), canvas.size, canvas.size,
+            GDT_Byte, outBands, nullptr, 0, 0, 0) != CE_None)
+        {
+            throw GDALException("Cannot write tile data");
+        }
+
+        const GDALDatasetH outDs = GDALCreateCopy(encoderDrv, tilePath.c_str(), dsTile, FALSE,
+            encoderCreateOptions, nullptr, nullptr);
+        if (outDs == nullptr)
+            throw GDALException("Cannot create output dataset " + tilePath);
+
+        GDALFlushCache(outDs);
+        GDALClose(outDs);
+    }
+
+    void GDALTiler::encodeTile(const TileCanvas& canvas, uint8_t **outBuffer, int *outBufferSize)
+    {
+        static std::atomic<uint64_t> counter(0);
+        const std::string vsiPath = "/vsimem/tile_" + std::to_string(reinterpret_cast<uintptr_t>(this)) +
+                                    "_" + std::to_string(counter++) + "." + tileExtension;
+
+        writeTile(canvas, vsiPath);
+
+        // Take ownership of the encoded bytes, this also removes the memory file
+        vsi_l_offset bufSize;
+        *outBuffer = VSIGetMemFileBuffer(vsiPath.c_str(), &bufSize, TRUE);
+        if (*outBuffer == nullptr)
+            throw GDALException("Cannot read encoded tile " + vsiPath);
+        if (bufSize > static_cast<vsi_l_offset>(std::numeric_limits<int>::max()))
+        {
+            VSIFree(*outBuffer);
+            *outBuffer = nullptr;
+            throw GDALException("Exceeded max buf size");
+        }
+        if (outBufferSize != nullptr)
+            *outBufferSize = static_cast<int>(bufSize);
     }
 
 } // namespace ddb
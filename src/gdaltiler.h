@@ -1,17 +1,31 @@
 #pragma once
 
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <vector>
+#include <memory>
 #include "tiler.h"
+#include "dataset_pool.h"
+#include "tile_cache.h"
+#include "tile_metrics.h"
+#include "source_fingerprint.h"
+#include "tile_warper.h"
 #include "gdal_inc.h"
 
 namespace ddb {
 
+    // Pixel window. 64-bit: before clipping to the raster, the window of a
+    // low zoom tile over a large high resolution input spans far more than
+    // 2^31 pixels.
     struct GeoExtent
     {
-        int x;
-        int y;
-        int xsize;
-        int ysize;
+        int64_t x;
+        int64_t y;
+        int64_t xsize;
+        int64_t ysize;
     };
 
     struct GQResult
@@ -20,23 +34,386 @@ namespace ddb {
         GeoExtent w;
     };
 
+    struct TileCoord
+    {
+        int z;
+        int x;
+        int y;
+    };
+
+    // Thread counts of the renderBatch pipeline stages
+    struct TilePipelineOptions
+    {
+        // geoQuery, source read, rescale and alpha read
+        int readers = 2;
+
+        // Tile encoding, 0 = hardware concurrency
+        int encoders = 0;
+
+        // Sink writes
+        int writers = 1;
+
+        // Tiles buffered between two stages. Also bounds the canvases in flight.
+        size_t queueDepth = 32;
+    };
+
+    struct TileStageStats
+    {
+        std::string name;
+        int workers = 0;
+        size_t items = 0;
+
+        // Time spent working, and blocked on the neighbouring queues
+        double busySeconds = 0.0;
+        double waitSeconds = 0.0;
+
+        // busySeconds / (workers x wall time): near 1 means the stage is the
+        // bottleneck and would benefit from more workers
+        double occupancy = 0.0;
+
+        // High-water mark of the queue feeding the stage
+        size_t maxQueueDepth = 0;
+    };
+
+    // Outcome of GDALTiler::renderBatch. Block cache figures are estimated
+    // by replaying the source blocks each tile reads through an LRU model
+    // of the GDAL block cache.
+    struct TileBatchStats
+    {
+        size_t tiles = 0;
+        size_t written = 0;
+
+        uint64_t blockReads = 0;
+        uint64_t blockCacheHits = 0;
+        double blockCacheHitRate = 0.0;
+
+        // Same estimate for the tiles in the order they were requested
+        double requestOrderHitRate = 0.0;
+
+        // Tiles left alone because the sink already had them up to date
+        size_t skipped = 0;
+
+        double seconds = 0.0;
+
+        // Read, encode and write stages, when pipelined
+        std::vector<TileStageStats> stages;
+    };
+
+    // Band-sequential 8-bit tile image, color bands followed by alpha
+    struct TileCanvas
+    {
+        int size = 0;
+        int bands = 0;
+        bool hasData = false;
+        std::vector<uint8_t> data;
+    };
+
+    enum class TileFormat
+    {
+        PNG,
+        WEBP,
+        JPEG
+    };
+
+    // Encoder settings, mapped to the GDAL driver creation options
+    struct TileEncoderOptions
+    {
+        TileFormat format = TileFormat::PNG;
+
+        // PNG zlib level (1-9). Level 1 is about twice as fast as the
+        // default 6 for slightly larger tiles.
+        int pngZLevel = 1;
+
+        // WebP and JPEG quality (1-100)
+        int quality = 75;
+
+        // Lossless WebP, quality then trades encode time for size
+        bool lossless = false;
+    };
+
+    // Resumable seed, see GDALTiler::seed
+    struct SeedOptions
+    {
+        // Area to seed (EPSG:3857), clipped to the raster
+        BoundingBox<Projected2D> bbox;
+        int minZ = 0;
+        int maxZ = 0;
+
+        // Other encoder settings are kept
+        TileFormat format = TileFormat::PNG;
+
+        // Completion state, saved every checkpointSeconds and at the end.
+        // Empty to seed without checkpoints.
+        std::string checkpointPath;
+        double checkpointSeconds = 30.0;
+
+        // 0 = hardware concurrency
+        int threads = 0;
+    };
+
+    struct SeedStats
+    {
+        // Tiles in the seed area
+        uint64_t total = 0;
+
+        // Tiles a previous run had already completed
+        uint64_t alreadyDone = 0;
+
+        // Tiles processed by this run, and how many of them were stored
+        // (empty tiles may be skipped) or found up to date in the sink
+        uint64_t rendered = 0;
+        uint64_t written = 0;
+        uint64_t skipped = 0;
+
+        size_t checkpoints = 0;
+        double seconds = 0.0;
+    };
+
 class GDALTiler : public Tiler {
 public:
     GDALTiler(const std::string& inputPath, const std::string& outputPath, int tileSize = 256, bool tms = false);
     ~GDALTiler();
 
-    std::string tile(int z, int x, int y);
+    // Renders tile z/x/y and stores it in the sink, returning where it went.
+    // If outBuffer is set, the encoded tile is returned in a buffer instead
+    // (free it with VSIFree), nothing touches the filesystem and the
+    // returned path is empty.
+    // Safe to call from several threads at once, each call reads through
+    // its own dataset handles (see setMaxDatasetHandles).
+    std::string tile(int z, int x, int y, uint8_t **outBuffer = nullptr, int *outBufferSize = nullptr);
+
+    // Renders every tile between minZ and maxZ (inclusive) using the given
+    // number of threads (0 = hardware concurrency). Each worker reads through
+    // its own dataset handles. With fromChildren, only maxZ is read from the
+    // source and every lower zoom is reduced 2x2 from its four children in memory.
+    // Returns the number of tiles written.
+    size_t buildPyramid(int minZ, int maxZ, int threads = 0, bool fromChildren = false);
+
+    // Renders and stores a batch of tiles (coordinates as for tile(),
+    // tiles outside the raster are ignored). The batch is reordered per zoom
+    // along a Hilbert curve over the source's block grid (GDALGetBlockSize),
+    // so consecutive tiles, and each worker's share, reuse cached blocks.
+    TileBatchStats renderBatch(const std::vector<TileCoord>& tiles, int threads = 0);
+
+    // Renders every tile between minZ and maxZ intersecting bbox (EPSG:3857)
+    TileBatchStats renderBatch(const BoundingBox<Projected2D>& bbox, int minZ, int maxZ, int threads = 0);
+
+    // Runs renderBatch as a pipeline instead: reader threads prefetch and
+    // rescale windows while encoder threads compress earlier tiles and writer
+    // threads store them, with bounded queues between the stages. The threads
+    // argument of renderBatch is then ignored.
+    void enablePipeline(const TilePipelineOptions& options = TilePipelineOptions());
+    void disablePipeline();
+
+    // Renders every tile of options.bbox between minZ and maxZ in chunks
+    // sized so that one chunk takes about checkpointSeconds. After each
+    // chunk the sink is flushed and a completion bitmap per zoom is saved to
+    // checkpointPath. A seed started again with the same input, area, zooms,
+    // format and tiling resumes from its checkpoint, a checkpoint written
+    // for anything else is ignored. Tiles are renamed into place once fully
+    // written, so a crash never leaves a truncated tile behind.
+    SeedStats seed(const SeedOptions& options);
+
+    // Incremental re-tiling after parts of the input were rewritten.
+    // Every block of the input is fingerprinted (CRC64) and compared with the
+    // fingerprints stored in manifestPath. Returns the tiles between minZ and
+    // maxZ (coordinates as for tile()) whose footprint overlaps a changed
+    // block, or every tile when the manifest is missing or was written for
+    // another raster layout. The tiler must be created after the input changed.
+    std::vector<TileCoord> changedTiles(const std::string& manifestPath, int minZ, int maxZ);
+
+    // Renders changedTiles() with renderBatch, regardless of setForceRender,
+    // then stores the new fingerprints in manifestPath so that the next run
+    // only sees later edits. With setSkipEmptyTiles, changed tiles that are
+    // now empty are removed from the sink. Changes of SRS or nodata values
+    // alone count as a new layout.
+    // Use the same zoom range as the seed the manifest belongs to.
+    TileBatchStats updateChangedTiles(const std::string& manifestPath, int minZ, int maxZ, int threads = 0);
+
+    // Renders buildPyramid tiles in tiles x tiles blocks (1 = off): each block
+    // is read and rescaled from the source in one window, then sliced and
+    // encoded tile by tile. Needs about tiles^2 times the memory of a tile
+    // per worker. Does not apply to fromChildren levels above maxZ.
+    void setMetatileSize(int tiles);
+
+    // Upper bound on the sets of dataset handles (input, warped VRT, warper)
+    // kept open for concurrent tile() calls and workers, hardware
+    // concurrency by default. Callers beyond it wait for a free set.
+    void setMaxDatasetHandles(size_t handles);
+
+    // Serves repeated tile() calls from a cache of encoded tiles: up to
+    // memoryBytes in memory, backed by up to diskBytes in diskPath
+    // (an empty diskPath keeps the cache in memory only).
+    void enableCache(size_t memoryBytes, const std::string& diskPath = "", size_t diskBytes = 0);
+    void disableCache();
+    TileCacheStats getCacheStats() const;
+
+    // Inputs not in EPSG:3857 are normally read through a warped VRT that
+    // reprojects on every read. This reprojects the input once into a tiled,
+    // compressed EPSG:3857 COG with overviews in cacheDir and reads every
+    // later tile from it. The COG is shared by tilers of the same input and
+    // rebuilt when the input file changes (size or modification time).
+    // Does nothing for inputs already in EPSG:3857.
+    void enableWarpCache(const std::string& cacheDir);
+
+    // Reprojects inputs not in EPSG:3857 by warping each tile straight into
+    // its canvas instead of reading through the warped VRT, reusing the
+    // transformer of each zoom level. Single tile() calls warp on all CPUs,
+    // batch renders on one thread per worker (see TileWarpOptions::threads).
+    // Does nothing for inputs already in EPSG:3857 or served from the warp cache.
+    void enableTileWarping(const TileWarpOptions& options = TileWarpOptions());
+
+    // Fully transparent tiles are not stored: tile() returns an empty path
+    // (or a shared transparent tile when writing to memory) and buildPyramid
+    // does not count them. Identical tiles are deduplicated by the sink,
+    // see DirectoryTileSink and MBTilesTileSink.
+    void setSkipEmptyTiles(bool skip);
+
+    // Output format and encoder settings, PNG at zlib level 1 by default.
+    // JPEG has no alpha: transparent areas are encoded black, so it is
+    // meant for opaque inputs. Switches the sink to the matching extension.
+    // Not to be called while tiles are being rendered.
+    void setEncoder(const TileEncoderOptions& options);
+    const TileEncoderOptions& getEncoder() const;
+
+    // Tiles already stored and written after the input file was last
+    // modified are reused instead of rendered again: tile() returns their path
+    // (or their bytes when writing to memory) and renderBatch and flat
+    // buildPyramid runs skip them, so restarted seeds resume quickly.
+    // Tiles written before the sink last saw a change of tile size, TMS or
+    // encoder settings are rendered again.
+    // Only sinks that know when a tile was written support this
+    // (DirectoryTileSink). Force renders every tile regardless, e.g. after
+    // the input was replaced by a file with an older modification time.
+    void setForceRender(bool force);
+
+    // Per-stage latency histograms (geoQuery, source read, rescale, alpha
+    // read, encode, write) with p50/p99, bytes read and written and tiles/sec.
+    // Off by default. Enabling starts a new measurement period.
+    void enableMetrics(bool enabled = true);
+    TileMetricsReport getMetrics() const;
+    void resetMetrics();
 
 private:
     std::string inputPath;
 
+    // EPSG:3857 copy of the input opened instead of it, see enableWarpCache
+    std::string materializedPath;
+    std::string buildWarpCache(const std::string& cacheDir);
+
+    bool tileWarping = false;
+    TileWarpOptions warpOptions;
+
     GDALDriverH pngDrv;
     GDALDriverH memDrv;
 
-    int rasterCount;
+    TileEncoderOptions encoder;
+    GDALDriverH encoderDrv = nullptr;
+    char** encoderCreateOptions = nullptr;
+
+    // Handles opened by the constructor, used for metadata and by the
+    // configuration methods. They seed the pool that rendering draws from.
+    // Configuration methods must not run concurrently with rendering.
+    TileDatasets datasets;
+    std::unique_ptr<DatasetPool> handles;
+    void reopenDatasets();
+    std::unique_ptr<TileCache> cache;
+
+    // TileCacheKey::source of this input and the current encoder settings,
+    // updated by enableCache and setEncoder
+    std::string cacheSource;
+    void updateCacheSource();
+
+    mutable TileMetrics metrics;
+
+    // sink->write, timed under TileStage::Write and counted as a tile
+    std::string writeToSink(int tz, int tx, int ty, const uint8_t* data, size_t size);
+
+    // Min/max over all rendered bands, used to rescale non-Byte inputs
+    double globalMin = 0.0;
+    double globalMax = 0.0;
+    bool hasStatistics = false;
+    void computeStatistics();
+
+    bool skipEmptyTiles = false;
+
+    // Skipped empty tiles are removed from the sink instead of left alone,
+    // set while updateChangedTiles replaces tiles that may now be empty
+    bool removeEmptyTiles = false;
+
+    bool forceRender = false;
+
+    // Modification time of the input when the tiler was created
+    std::filesystem::file_time_type sourceTime;
+
+    // Stored tiles are up to date if written after both the input and the
+    // sink's adoption of the current settings (see TileSink::settingsTime).
+    // Synced at the start of tile(), renderBatch and buildPyramid, and again
+    // after setEncoder or a sink change.
+    std::mutex freshMutex;
+    const TileSink* freshSink = nullptr;
+    std::filesystem::file_time_type freshSince;
+    void syncFreshness();
+    std::string renderSettings() const;
+
+    // Whether the sink holds an up to date copy of the tile (output y)
+    bool isFresh(int tz, int tx, int ty) const;
+
+    // Encoded fully transparent tile, built on first use
+    std::vector<uint8_t> emptyTile;
+    std::mutex emptyTileMutex;
+    const std::vector<uint8_t>& getEmptyTile();
+    bool isEmpty(const TileCanvas& canvas) const;
+
+    TileDatasets openDatasets();
+    void closeDatasets(TileDatasets& ds);
+
+    // Renders tile tz/tx/ty (y in internal, non-TMS order) from ds into canvas.
+    // Returns false if the tile does not intersect the raster.
+    bool renderTile(const TileDatasets& ds, int tz, int tx, int ty, TileCanvas& canvas);
+
+    // Renders the tiles x tiles block whose lower left tile is tx/ty into a
+    // single canvas. window is the part of the canvas covered by the raster.
+    bool renderRegion(const TileDatasets& ds, int tz, int tx, int ty, int tiles,
+                      TileCanvas& canvas, GeoExtent& window);
+
+    int metatileSize = 1;
+
+    bool pipelined = false;
+    TilePipelineOptions pipelineOptions;
+
+    // Renders tasks (internal y) through the read/encode/write pipeline,
+    // returns the number of tiles written
+    size_t runPipeline(const std::vector<TileCoord>& tasks, TileBatchStats& stats);
+
+    // Fingerprints the input into current and returns the tiles touched by
+    // blocks that differ from the manifest
+    std::vector<TileCoord> findChangedTiles(const std::string& manifestPath, int minZ, int maxZ,
+                                            SourceFingerprint& current);
+
+    // Tiles of a batch in rendering order (internal y), fills the block
+    // cache estimates of stats
+    std::vector<TileCoord> scheduleBatch(const std::vector<TileCoord>& tiles, TileBatchStats& stats);
+
+    // Renders and stores the tiles of the metatile whose lower left tile is
+    // tx/ty, returns the number of tiles written
+    size_t renderMetatile(const TileDatasets& ds, BoundingBox<Projected2Di> bounds,
+                          int tz, int tx, int ty);
+    void writeTile(const TileCanvas& canvas, const std::string& tilePath);
+    void encodeTile(const TileCanvas& canvas, uint8_t **outBuffer, int *outBufferSize);
+
+    // Encodes canvas into the sink, y in output (getTilePath) order.
+    // Returns where the tile was stored, or an empty string if it was
+    // skipped for being empty.
+    std::string storeTile(const TileCanvas& canvas, int tz, int tx, int ty);
+
+    void initCanvas(TileCanvas& canvas, int tiles = 1);
+    void reduceChild(const TileCanvas& child, TileCanvas& parent, int qx, int qy);
+    size_t buildFromChildren(const TileDatasets& ds, const std::vector<BoundingBox<Projected2Di>>& bounds,
+                             int maxZ, int tz, int tx, int ty, TileCanvas& canvas);
 
-    GDALDatasetH inputDataset = nullptr;
-    GDALDatasetH origDataset = nullptr;
+    void runOnWorkers(const std::vector<TileCoord>& tasks, int threads,
+                      const std::function<void(const TileDatasets&, const TileCoord&)>& fn);
 
     GQResult geoQuery(GDALDatasetH ds, double ulx, double uly, double lrx, double lry, int querySize = 0);
     int dataBandsCount(const GDALDatasetH& dataset);
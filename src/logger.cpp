@@ -0,0 +1,90 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "logger.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+namespace ddb {
+
+    namespace
+    {
+        LogLevel initialLevel()
+        {
+            const char* env = std::getenv("DDB_LOG_LEVEL");
+            if (env == nullptr)
+                return LogLevel::Warning;
+
+            if (std::strcmp(env, "debug") == 0)
+                return LogLevel::Debug;
+            if (std::strcmp(env, "info") == 0)
+                return LogLevel::Info;
+            if (std::strcmp(env, "error") == 0)
+                return LogLevel::Error;
+            if (std::strcmp(env, "off") == 0)
+                return LogLevel::Off;
+            return LogLevel::Warning;
+        }
+
+        std::atomic<int>& currentLevel()
+        {
+            static std::atomic<int> level(static_cast<int>(initialLevel()));
+            return level;
+        }
+
+        const char* prefix(LogLevel level)
+        {
+            switch (level)
+            {
+            case LogLevel::Debug:
+                return "[DEBUG] ";
+            case LogLevel::Info:
+                return "[INFO] ";
+            case LogLevel::Warning:
+                return "[WARNING] ";
+            case LogLevel::Error:
+                return "[ERROR] ";
+            default:
+                return "";
+            }
+        }
+    }
+
+    void setLogLevel(LogLevel level)
+    {
+        currentLevel().store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    LogLevel getLogLevel()
+    {
+        return static_cast<LogLevel>(currentLevel().load(std::memory_order_relaxed));
+    }
+
+    bool logEnabled(LogLevel level)
+    {
+        return static_cast<int>(level) >= currentLevel().load(std::memory_order_relaxed);
+    }
+
+    LogMessage::LogMessage(LogLevel level) : level(level)
+    {
+        ss << prefix(level);
+    }
+
+    LogMessage::~LogMessage()
+    {
+        static std::mutex mutex;
+
+        ss << '\n';
+        const std::string line = ss.str();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ostream& out = level >= LogLevel::Warning ? std::cerr : std::cout;
+        out << line;
+        out.flush();
+    }
+
+}
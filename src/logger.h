@@ -0,0 +1,57 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <sstream>
+
+// Statements below this level are removed at compile time
+// (0 = Debug ... 4 = Off)
+#ifndef DDB_LOG_MIN_LEVEL
+#define DDB_LOG_MIN_LEVEL 0
+#endif
+
+namespace ddb {
+
+    enum class LogLevel
+    {
+        Debug = 0,
+        Info = 1,
+        Warning = 2,
+        Error = 3,
+        Off = 4
+    };
+
+    // Defaults to Warning, or to the DDB_LOG_LEVEL environment variable
+    // (debug, info, warning, error, off)
+    void setLogLevel(LogLevel level);
+    LogLevel getLogLevel();
+    bool logEnabled(LogLevel level);
+
+    // Buffers one line and prints it on destruction, so lines written by
+    // different threads do not interleave
+    class LogMessage
+    {
+    public:
+        explicit LogMessage(LogLevel level);
+        ~LogMessage();
+
+        LogMessage(const LogMessage&) = delete;
+        LogMessage& operator=(const LogMessage&) = delete;
+
+        std::ostream& stream() { return ss; }
+
+    private:
+        LogLevel level;
+        std::ostringstream ss;
+    };
+
+}
+
+// DDB_LOG(Debug) << "value: " << v;
+// Arguments are not evaluated when the level is disabled.
+#define DDB_LOG(level)                                                              \
+    if (static_cast<int>(ddb::LogLevel::level) < DDB_LOG_MIN_LEVEL ||              \
+        !ddb::logEnabled(ddb::LogLevel::level)) {}                                  \
+    else                                                                            \
+        ddb::LogMessage(ddb::LogLevel::level).stream()
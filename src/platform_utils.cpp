@@ -4,10 +4,14 @@
 #include <cstdlib>
 #include <clocale>
 
+#include <fstream>
+
 #ifdef WIN32
 #include <windows.h>
+#include <psapi.h>
 #else
 #include <unistd.h>
+#include <sys/resource.h>
 #endif
 
 namespace PlatformUtils {
@@ -98,4 +102,41 @@ void setupLocale() {
     }
 }
 
+uint64_t getPeakResidentSetSize() {
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return static_cast<uint64_t>(counters.PeakWorkingSetSize);
+    return 0;
+#else
+#ifdef __linux__
+    // VmHWM follows resetPeakResidentSetSize, ru_maxrss does not
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0)
+            return std::stoull(line.substr(6)) * 1024;
+    }
+#endif
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+bool resetPeakResidentSetSize() {
+#ifdef __linux__
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    return static_cast<bool>(clearRefs.flush());
+#else
+    return false;
+#endif
+}
+
 } // namespace PlatformUtils
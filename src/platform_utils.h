@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <filesystem>
 
@@ -27,4 +28,17 @@ namespace PlatformUtils {
      * Setup locale settings for consistent behavior across platforms
      */
     void setupLocale();
+
+    /**
+     * Peak resident set size of the process
+     * @return Bytes, 0 if not available
+     */
+    uint64_t getPeakResidentSetSize();
+
+    /**
+     * Restart peak resident set size tracking from the current usage
+     * (Linux only, elsewhere the peak covers the whole process lifetime)
+     * @return true if the peak was reset
+     */
+    bool resetPeakResidentSetSize();
 }
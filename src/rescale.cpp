@@ -0,0 +1,313 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "rescale.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define DDB_RESCALE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DDB_TARGET_AVX2
+#else
+#define DDB_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define DDB_RESCALE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace ddb
+{
+
+    template <typename T>
+    void rescaleScalar(const T* src, uint8_t* dst, size_t n, double bMin, double bMax)
+    {
+        const double deltamm = bMax - bMin;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            double v = std::max(bMin, std::min(bMax, static_cast<double>(src[i])));
+            dst[i] = static_cast<uint8_t>(255.0 * (v - bMin) / deltamm);
+        }
+    }
+
+    namespace
+    {
+        template <typename T>
+        using Kernel = void (*)(const T*, uint8_t*, size_t, double, double);
+
+        // The vector kernels below reproduce the scalar expression operation by
+        // operation: min/max are ordered so that equal or NaN inputs pick the
+        // same operand as std::min/std::max, then sub, mul, div and truncate.
+
+#ifdef DDB_RESCALE_X86
+
+        inline __m128d loadSse2(const double* p) { return _mm_loadu_pd(p); }
+        inline __m128d loadSse2(const float* p)
+        {
+            return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+        }
+        inline __m128d loadSse2(const int32_t* p)
+        {
+            return _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+        }
+        inline __m128d loadSse2(const uint32_t* p)
+        {
+            // Flip into signed range, convert exactly, shift back
+            const __m128i v = _mm_xor_si128(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+                                            _mm_set1_epi32(static_cast<int>(0x80000000u)));
+            return _mm_add_pd(_mm_cvtepi32_pd(v), _mm_set1_pd(2147483648.0));
+        }
+
+        template <typename T>
+        void rescaleSse2(const T* src, uint8_t* dst, size_t n, double bMin, double bMax)
+        {
+            const __m128d vMin = _mm_set1_pd(bMin);
+            const __m128d vMax = _mm_set1_pd(bMax);
+            const __m128d vDelta = _mm_set1_pd(bMax - bMin);
+            const __m128d v255 = _mm_set1_pd(255.0);
+
+            size_t i = 0;
+            for (; i + 2 <= n; i += 2)
+            {
+                __m128d v = _mm_min_pd(loadSse2(src + i), vMax);
+                v = _mm_max_pd(v, vMin);
+                v = _mm_div_pd(_mm_mul_pd(v255, _mm_sub_pd(v, vMin)), vDelta);
+
+                __m128i b = _mm_cvttpd_epi32(v);
+                b = _mm_packus_epi16(_mm_packs_epi32(b, b), b);
+                const uint16_t out = static_cast<uint16_t>(_mm_cvtsi128_si32(b));
+                std::memcpy(dst + i, &out, sizeof(out));
+            }
+
+            rescaleScalar(src + i, dst + i, n - i, bMin, bMax);
+        }
+
+        DDB_TARGET_AVX2 inline __m256d loadAvx2(const double* p) { return _mm256_loadu_pd(p); }
+        DDB_TARGET_AVX2 inline __m256d loadAvx2(const float* p)
+        {
+            return _mm256_cvtps_pd(_mm_loadu_ps(p));
+        }
+        DDB_TARGET_AVX2 inline __m256d loadAvx2(const int32_t* p)
+        {
+            return _mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        }
+        DDB_TARGET_AVX2 inline __m256d loadAvx2(const uint32_t* p)
+        {
+            const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)),
+                                            _mm_set1_epi32(static_cast<int>(0x80000000u)));
+            return _mm256_add_pd(_mm256_cvtepi32_pd(v), _mm256_set1_pd(2147483648.0));
+        }
+
+        template <typename T>
+        DDB_TARGET_AVX2 void rescaleAvx2(const T* src, uint8_t* dst, size_t n, double bMin, double bMax)
+        {
+            const __m256d vMin = _mm256_set1_pd(bMin);
+            const __m256d vMax = _mm256_set1_pd(bMax);
+            const __m256d vDelta = _mm256_set1_pd(bMax - bMin);
+            const __m256d v255 = _mm256_set1_pd(255.0);
+
+            size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                __m256d v = _mm256_min_pd(loadAvx2(src + i), vMax);
+                v = _mm256_max_pd(v, vMin);
+                v = _mm256_div_pd(_mm256_mul_pd(v255, _mm256_sub_pd(v, vMin)), vDelta);
+
+                __m128i b = _mm256_cvttpd_epi32(v);
+                b = _mm_packus_epi16(_mm_packs_epi32(b, b), b);
+                const uint32_t out = static_cast<uint32_t>(_mm_cvtsi128_si32(b));
+                std::memcpy(dst + i, &out, sizeof(out));
+            }
+
+            rescaleScalar(src + i, dst + i, n - i, bMin, bMax);
+        }
+
+        bool hasAvx2()
+        {
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+
+            // The OS must also save YMM registers
+            __cpuid(info, 1);
+            const bool osxsave = (info[2] & (1 << 27)) != 0;
+            if (!osxsave || (_xgetbv(0) & 6) != 6)
+                return false;
+
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            return __builtin_cpu_supports("avx2");
+#endif
+        }
+
+#endif
+
+#ifdef DDB_RESCALE_NEON
+
+        inline float64x2_t loadNeon(const double* p) { return vld1q_f64(p); }
+        inline float64x2_t loadNeon(const float* p) { return vcvt_f64_f32(vld1_f32(p)); }
+        inline float64x2_t loadNeon(const int32_t* p) { return vcvtq_f64_s64(vmovl_s32(vld1_s32(p))); }
+        inline float64x2_t loadNeon(const uint32_t* p) { return vcvtq_f64_u64(vmovl_u32(vld1_u32(p))); }
+
+        template <typename T>
+        void rescaleNeon(const T* src, uint8_t* dst, size_t n, double bMin, double bMax)
+        {
+            const float64x2_t vMin = vdupq_n_f64(bMin);
+            const float64x2_t vMax = vdupq_n_f64(bMax);
+            const float64x2_t vDelta = vdupq_n_f64(bMax - bMin);
+            const float64x2_t v255 = vdupq_n_f64(255.0);
+
+            size_t i = 0;
+            for (; i + 2 <= n; i += 2)
+            {
+                // vminq/vmaxq propagate NaN, select explicitly instead
+                float64x2_t v = loadNeon(src + i);
+                v = vbslq_f64(vcltq_f64(v, vMax), v, vMax);
+                v = vbslq_f64(vcltq_f64(vMin, v), v, vMin);
+                v = vdivq_f64(vmulq_f64(v255, vsubq_f64(v, vMin)), vDelta);
+
+                const uint64x2_t b = vcvtq_u64_f64(v);
+                dst[i] = static_cast<uint8_t>(vgetq_lane_u64(b, 0));
+                dst[i + 1] = static_cast<uint8_t>(vgetq_lane_u64(b, 1));
+            }
+
+            rescaleScalar(src + i, dst + i, n - i, bMin, bMax);
+        }
+
+#endif
+
+        template <typename T>
+        Kernel<T> selectKernel()
+        {
+#if defined(DDB_RESCALE_X86)
+            if (hasAvx2())
+                return rescaleAvx2<T>;
+            return rescaleSse2<T>;
+#elif defined(DDB_RESCALE_NEON)
+            return rescaleNeon<T>;
+#else
+            return rescaleScalar<T>;
+#endif
+        }
+
+        // One table per (bMin, bMax) pair, indexed by value - min(T).
+        // A tiler uses a single pair, so only a handful are ever alive.
+        template <typename T>
+        std::shared_ptr<const std::vector<uint8_t>> lookupTable(double bMin, double bMax)
+        {
+            static std::mutex mutex;
+            static std::map<std::pair<double, double>, std::shared_ptr<const std::vector<uint8_t>>> tables;
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = tables.find({ bMin, bMax });
+            if (it != tables.end())
+                return it->second;
+
+            constexpr size_t entries = size_t(1) << (8 * sizeof(T));
+            std::vector<T> values(entries);
+            for (size_t i = 0; i < entries; i++)
+                values[i] = static_cast<T>(static_cast<int64_t>(std::numeric_limits<T>::min()) + static_cast<int64_t>(i));
+
+            auto table = std::make_shared<std::vector<uint8_t>>(entries);
+            rescaleScalar(values.data(), table->data(), entries, bMin, bMax);
+
+            if (tables.size() >= 8)
+                tables.clear();
+            tables[{ bMin, bMax }] = table;
+
+            return table;
+        }
+    }
+
+    template <typename T>
+    void rescaleBuffer(const T* src, uint8_t* dst, size_t n, double bMin, double bMax)
+    {
+        if constexpr (std::is_integral<T>::value && sizeof(T) <= 2)
+        {
+            const auto table = lookupTable<T>(bMin, bMax);
+            const uint8_t* lut = table->data();
+            const int64_t offset = std::numeric_limits<T>::min();
+
+            for (size_t i = 0; i < n; i++)
+                dst[i] = lut[static_cast<int64_t>(src[i]) - offset];
+        }
+        else
+        {
+            static const Kernel<T> kernel = selectKernel<T>();
+            kernel(src, dst, n, bMin, bMax);
+        }
+    }
+
+    const char* rescaleKernelName()
+    {
+#if defined(DDB_RESCALE_X86)
+        return hasAvx2() ? "avx2" : "sse2";
+#elif defined(DDB_RESCALE_NEON)
+        return "neon";
+#else
+        return "scalar";
+#endif
+    }
+
+    template <typename T>
+    std::vector<RescaleKernel<T>> rescaleKernels()
+    {
+        std::vector<RescaleKernel<T>> kernels;
+        if constexpr (std::is_integral<T>::value && sizeof(T) <= 2)
+        {
+            kernels.push_back({ "lut", rescaleBuffer<T> });
+        }
+        else
+        {
+#if defined(DDB_RESCALE_X86)
+            if (hasAvx2())
+                kernels.push_back({ "avx2", rescaleAvx2<T> });
+            kernels.push_back({ "sse2", rescaleSse2<T> });
+#elif defined(DDB_RESCALE_NEON)
+            kernels.push_back({ "neon", rescaleNeon<T> });
+#endif
+        }
+        kernels.push_back({ "dispatch", rescaleBuffer<T> });
+        return kernels;
+    }
+
+    template void rescaleBuffer<uint8_t>(const uint8_t*, uint8_t*, size_t, double, double);
+    template void rescaleBuffer<uint16_t>(const uint16_t*, uint8_t*, size_t, double, double);
+    template void rescaleBuffer<int16_t>(const int16_t*, uint8_t*, size_t, double, double);
+    template void rescaleBuffer<uint32_t>(const uint32_t*, uint8_t*, size_t, double, double);
+    template void rescaleBuffer<int32_t>(const int32_t*, uint8_t*, size_t, double, double);
+    template void rescaleBuffer<float>(const float*, uint8_t*, size_t, double, double);
+    template void rescaleBuffer<double>(const double*, uint8_t*, size_t, double, double);
+
+    template std::vector<RescaleKernel<uint8_t>> rescaleKernels<uint8_t>();
+    template std::vector<RescaleKernel<uint16_t>> rescaleKernels<uint16_t>();
+    template std::vector<RescaleKernel<int16_t>> rescaleKernels<int16_t>();
+    template std::vector<RescaleKernel<uint32_t>> rescaleKernels<uint32_t>();
+    template std::vector<RescaleKernel<int32_t>> rescaleKernels<int32_t>();
+    template std::vector<RescaleKernel<float>> rescaleKernels<float>();
+    template std::vector<RescaleKernel<double>> rescaleKernels<double>();
+
+    template void rescaleScalar<uint8_t>(const uint8_t*, uint8_t*, size_t, double, double);
+    template void rescaleScalar<uint16_t>(const uint16_t*, uint8_t*, size_t, double, double);
+    template void rescaleScalar<int16_t>(const int16_t*, uint8_t*, size_t, double, double);
+    template void rescaleScalar<uint32_t>(const uint32_t*, uint8_t*, size_t, double, double);
+    template void rescaleScalar<int32_t>(const int32_t*, uint8_t*, size_t, double, double);
+    template void rescaleScalar<float>(const float*, uint8_t*, size_t, double, double);
+    template void rescaleScalar<double>(const double*, uint8_t*, size_t, double, double);
+
+}
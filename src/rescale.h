@@ -0,0 +1,41 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace ddb {
+
+    // Maps n samples to 0-255: 255 * (clamp(v, bMin, bMax) - bMin) / (bMax - bMin),
+    // truncated. bMax must be greater than bMin.
+    // 8 and 16 bit types go through a lookup table built once per (bMin, bMax),
+    // the others through the widest SIMD kernel the CPU supports.
+    // Output is bit-identical to rescaleScalar.
+    template <typename T>
+    void rescaleBuffer(const T* src, uint8_t* dst, size_t n, double bMin, double bMax);
+
+    // Reference implementation
+    template <typename T>
+    void rescaleScalar(const T* src, uint8_t* dst, size_t n, double bMin, double bMax);
+
+    // Name of the kernel used for 32/64 bit types ("avx2", "sse2", "neon" or "scalar")
+    const char* rescaleKernelName();
+
+    template <typename T>
+    struct RescaleKernel
+    {
+        const char* name;
+        void (*fn)(const T*, uint8_t*, size_t, double, double);
+    };
+
+    // Every implementation rescaleBuffer may use for T on this CPU
+    // ("lut" for 8 and 16 bit types, else "avx2", "sse2" or "neon"),
+    // followed by rescaleBuffer itself ("dispatch"), so that each can be
+    // checked against rescaleScalar
+    template <typename T>
+    std::vector<RescaleKernel<T>> rescaleKernels();
+
+}
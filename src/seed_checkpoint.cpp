@@ -0,0 +1,142 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "seed_checkpoint.h"
+#include "exceptions.h"
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace ddb {
+
+    namespace
+    {
+        const char* header = "ddb-seed-checkpoint 1";
+
+        size_t popCount(const std::vector<uint8_t>& bits)
+        {
+            size_t n = 0;
+            for (uint8_t b : bits)
+            {
+                for (; b != 0; b &= static_cast<uint8_t>(b - 1))
+                    n++;
+            }
+            return n;
+        }
+    }
+
+    SeedCheckpoint::SeedCheckpoint(int minZ, const std::vector<BoundingBox<Projected2Di>>& ranges,
+                                   const std::string& signature)
+        : minZ(minZ), signature(signature)
+    {
+        for (const auto& r : ranges)
+        {
+            Level l;
+            l.range = r;
+            if (r.max.x >= r.min.x && r.max.y >= r.min.y)
+            {
+                l.width = static_cast<uint64_t>(r.max.x - r.min.x + 1);
+                const uint64_t count = l.width * static_cast<uint64_t>(r.max.y - r.min.y + 1);
+                l.bits.assign(static_cast<size_t>((count + 7) / 8), 0);
+                totalTiles += count;
+            }
+            levels.push_back(std::move(l));
+        }
+    }
+
+    int64_t SeedCheckpoint::bitIndex(int z, int x, int y, const Level*& level) const
+    {
+        const int i = z - minZ;
+        if (i < 0 || i >= static_cast<int>(levels.size()))
+            return -1;
+
+        level = &levels[i];
+        BoundingBox<Projected2Di> r = level->range;
+        if (level->width == 0 || !r.contains(x, y))
+            return -1;
+
+        return static_cast<int64_t>(static_cast<uint64_t>(y - r.min.y) * level->width +
+                                    static_cast<uint64_t>(x - r.min.x));
+    }
+
+    bool SeedCheckpoint::isDone(int z, int x, int y) const
+    {
+        const Level* level = nullptr;
+        const int64_t bit = bitIndex(z, x, y, level);
+        return bit >= 0 && (level->bits[bit >> 3] & (1u << (bit & 7))) != 0;
+    }
+
+    void SeedCheckpoint::markDone(int z, int x, int y)
+    {
+        const Level* found = nullptr;
+        const int64_t bit = bitIndex(z, x, y, found);
+        if (bit < 0)
+            return;
+
+        uint8_t& byte = levels[z - minZ].bits[bit >> 3];
+        const uint8_t mask = static_cast<uint8_t>(1u << (bit & 7));
+        if ((byte & mask) == 0)
+        {
+            byte |= mask;
+            doneTiles++;
+        }
+    }
+
+    bool SeedCheckpoint::load(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open())
+            return false;
+
+        std::string line, savedSignature;
+        std::getline(in, line);
+        std::getline(in, savedSignature);
+        if (line != header || savedSignature != signature)
+            return false;
+
+        // Bitmaps follow in zoom order, sizes are implied by the signature
+        std::vector<Level> loaded = levels;
+        uint64_t done = 0;
+        for (Level& l : loaded)
+        {
+            in.read(reinterpret_cast<char*>(l.bits.data()), static_cast<std::streamsize>(l.bits.size()));
+            if (!in)
+                return false;
+            done += popCount(l.bits);
+        }
+
+        levels = std::move(loaded);
+        doneTiles = done;
+        return true;
+    }
+
+    void SeedCheckpoint::save(const std::string& path) const
+    {
+        const std::string tmpPath = path + "." +
+            std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!out.is_open())
+                throw GDALException("Cannot create " + tmpPath);
+
+            out << header << "\n" << signature << "\n";
+            for (const Level& l : levels)
+                out.write(reinterpret_cast<const char*>(l.bits.data()), static_cast<std::streamsize>(l.bits.size()));
+
+            if (!out.flush())
+                throw GDALException("Cannot write " + tmpPath);
+        }
+
+        std::error_code ec;
+        fs::rename(tmpPath, path, ec);
+        if (ec)
+        {
+            fs::remove(tmpPath, ec);
+            throw GDALException("Cannot replace " + path);
+        }
+    }
+
+}
@@ -0,0 +1,56 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "geo.h"
+
+namespace ddb {
+
+    // Completion state of a seed: one bitmap per zoom over the tile range
+    // the seed covers at that zoom
+    class SeedCheckpoint
+    {
+    public:
+        // ranges[i] holds the tiles of zoom minZ + i (internal y).
+        // signature identifies the seed (input, area, zooms, format...):
+        // a checkpoint is only resumed by the seed that wrote it.
+        SeedCheckpoint(int minZ, const std::vector<BoundingBox<Projected2Di>>& ranges,
+                       const std::string& signature);
+
+        // Restores the bitmaps saved at path. Returns false, leaving every
+        // tile pending, if there is no checkpoint or it belongs to another seed.
+        bool load(const std::string& path);
+
+        // Written to a temporary file renamed over path, so a crash leaves
+        // either the previous or the new checkpoint
+        void save(const std::string& path) const;
+
+        bool isDone(int z, int x, int y) const;
+        void markDone(int z, int x, int y);
+
+        uint64_t total() const { return totalTiles; }
+        uint64_t completed() const { return doneTiles; }
+
+    private:
+        struct Level
+        {
+            BoundingBox<Projected2Di> range;
+            uint64_t width = 0;
+            std::vector<uint8_t> bits;
+        };
+
+        int minZ;
+        std::string signature;
+        std::vector<Level> levels;
+        uint64_t totalTiles = 0;
+        uint64_t doneTiles = 0;
+
+        // Bit of z/x/y, or -1 outside the seed
+        int64_t bitIndex(int z, int x, int y, const Level*& level) const;
+    };
+
+}
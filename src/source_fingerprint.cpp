@@ -0,0 +1,201 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "source_fingerprint.h"
+#include "exceptions.h"
+#include "hash.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace ddb {
+
+    namespace
+    {
+        const char* header = "ddb-source-fingerprint 2";
+        const char* headerPrefix = "ddb-source-fingerprint ";
+    }
+
+    SourceFingerprint SourceFingerprint::compute(GDALDatasetH ds)
+    {
+        SourceFingerprint f;
+        f.width = GDALGetRasterXSize(ds);
+        f.height = GDALGetRasterYSize(ds);
+        f.bands = GDALGetRasterCount(ds);
+        if (f.bands == 0)
+            throw GDALException("Cannot fingerprint a dataset without bands");
+
+        GDALRasterBandH band = GDALGetRasterBand(ds, 1);
+        const GDALDataType type = GDALGetRasterDataType(band);
+        f.dataType = GDALGetDataTypeName(type);
+        GDALGetBlockSize(band, &f.blockWidth, &f.blockHeight);
+        f.blockWidth = std::max(1, f.blockWidth);
+        f.blockHeight = std::max(1, f.blockHeight);
+
+        if (GDALGetGeoTransform(ds, f.geoTransform) != CE_None)
+            throw GDALException("Cannot fetch geotransform for fingerprinting");
+
+        // Either one changes every tile without touching a pixel
+        const char* wkt = GDALGetProjectionRef(ds);
+        if (wkt != nullptr && *wkt != '\0')
+            f.srs = Hash::strCRC64(wkt, std::strlen(wkt));
+
+        for (int i = 1; i <= f.bands; i++)
+        {
+            int hasNodata = 0;
+            const double value = GDALGetRasterNoDataValue(GDALGetRasterBand(ds, i), &hasNodata);
+            std::ostringstream token;
+            token.precision(17);
+            if (hasNodata)
+                token << value;
+            else
+                token << "none";
+            f.nodata.push_back(token.str());
+        }
+
+        // Striped files report one-row blocks, group them so that a
+        // fingerprint stays small and each entry covers a useful area
+        if (f.blockHeight < 64 && f.blockWidth == f.width)
+            f.blockHeight = std::min(f.height, 64 / f.blockHeight * f.blockHeight);
+
+        const int typeSize = GDALGetDataTypeSizeBytes(type);
+        std::vector<char> buffer(static_cast<size_t>(f.blockWidth) * f.blockHeight * f.bands * typeSize);
+
+        const int nx = f.blocksX(), ny = f.blocksY();
+        f.blocks.reserve(static_cast<size_t>(nx) * ny);
+        for (int by = 0; by < ny; by++)
+        {
+            for (int bx = 0; bx < nx; bx++)
+            {
+                const int x = bx * f.blockWidth, y = by * f.blockHeight;
+                const int w = std::min(f.blockWidth, f.width - x);
+                const int h = std::min(f.blockHeight, f.height - y);
+
+                // Only the valid part of edge blocks, padding is not content
+                if (GDALDatasetRasterIO(ds, GF_Read, x, y, w, h, buffer.data(), w, h, type,
+                                        f.bands, nullptr, 0, 0, 0) != CE_None)
+                {
+                    throw GDALException("Cannot read block " + std::to_string(bx) + "," + std::to_string(by));
+                }
+
+                f.blocks.push_back(Hash::strCRC64(buffer.data(), static_cast<uint64_t>(w) * h * f.bands * typeSize));
+            }
+        }
+
+        return f;
+    }
+
+    SourceFingerprint SourceFingerprint::load(const std::string& path)
+    {
+        SourceFingerprint f;
+
+        std::ifstream in(path);
+        if (!in.is_open())
+            return f;
+
+        std::string line;
+        std::getline(in, line);
+        if (line.rfind(headerPrefix, 0) != 0)
+            throw GDALException("Not a source fingerprint: " + path);
+
+        // Older versions lack fields sameLayout needs: everything is re-rendered
+        if (line != header)
+            return f;
+
+        std::string key;
+        in >> key >> f.width >> f.height >> f.bands >> f.dataType;
+        in >> key >> f.blockWidth >> f.blockHeight;
+        in >> key;
+        for (double& g : f.geoTransform)
+            in >> g;
+        in >> key >> f.srs;
+        if (f.srs == "-")
+            f.srs.clear();
+        in >> key;
+        f.nodata.resize(f.bands > 0 ? static_cast<size_t>(f.bands) : 0);
+        for (std::string& v : f.nodata)
+            in >> v;
+        if (!in || f.blockWidth <= 0 || f.blockHeight <= 0)
+            throw GDALException("Corrupted source fingerprint: " + path);
+
+        const size_t count = static_cast<size_t>(f.blocksX()) * f.blocksY();
+        f.blocks.reserve(count);
+        std::string crc;
+        while (f.blocks.size() < count && in >> crc)
+            f.blocks.push_back(crc);
+
+        // A truncated file cannot tell what changed
+        if (f.blocks.size() != count)
+            return SourceFingerprint();
+
+        return f;
+    }
+
+    void SourceFingerprint::save(const std::string& path) const
+    {
+        const std::string tmpPath = path + "." +
+            std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream out(tmpPath, std::ios::trunc);
+            if (!out.is_open())
+                throw GDALException("Cannot create " + tmpPath);
+
+            out.precision(17);
+            out << header << "\n";
+            out << "raster " << width << " " << height << " " << bands << " " << dataType << "\n";
+            out << "blocks " << blockWidth << " " << blockHeight << "\n";
+            out << "geotransform";
+            for (double g : geoTransform)
+                out << " " << g;
+            out << "\n";
+            out << "srs " << (srs.empty() ? "-" : srs) << "\n";
+            out << "nodata";
+            for (const std::string& v : nodata)
+                out << " " << v;
+            out << "\n";
+            for (const std::string& crc : blocks)
+                out << crc << "\n";
+
+            if (!out.flush())
+                throw GDALException("Cannot write " + tmpPath);
+        }
+
+        std::error_code ec;
+        fs::rename(tmpPath, path, ec);
+        if (ec)
+        {
+            fs::remove(tmpPath, ec);
+            throw GDALException("Cannot replace " + path);
+        }
+    }
+
+    bool SourceFingerprint::sameLayout(const SourceFingerprint& other) const
+    {
+        return width == other.width && height == other.height && bands == other.bands &&
+               dataType == other.dataType && blockWidth == other.blockWidth &&
+               blockHeight == other.blockHeight &&
+               std::equal(std::begin(geoTransform), std::end(geoTransform), std::begin(other.geoTransform)) &&
+               srs == other.srs && nodata == other.nodata;
+    }
+
+    std::vector<std::pair<int, int>> SourceFingerprint::changedBlocks(const SourceFingerprint& previous) const
+    {
+        const bool all = previous.empty() || !sameLayout(previous);
+        const int nx = blocksX();
+
+        std::vector<std::pair<int, int>> changed;
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            if (all || blocks[i] != previous.blocks[i])
+                changed.push_back({ static_cast<int>(i % nx), static_cast<int>(i / nx) });
+        }
+        return changed;
+    }
+
+}
@@ -0,0 +1,61 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "gdal_inc.h"
+
+namespace ddb {
+
+    // CRC64 of every block of a raster (all bands), used to find the
+    // regions that changed between two versions of a file
+    class SourceFingerprint
+    {
+    public:
+        // Reads the whole dataset once, block by block
+        static SourceFingerprint compute(GDALDatasetH ds);
+
+        // Empty fingerprint if path does not exist
+        static SourceFingerprint load(const std::string& path);
+
+        // Written to a temporary file renamed over path
+        void save(const std::string& path) const;
+
+        bool empty() const { return blocks.empty(); }
+
+        // Same size, block size, bands, data type, geotransform, SRS and
+        // nodata values
+        bool sameLayout(const SourceFingerprint& other) const;
+
+        // Blocks (bx, by) whose content differs from previous,
+        // every block if previous is empty or has another layout
+        std::vector<std::pair<int, int>> changedBlocks(const SourceFingerprint& previous) const;
+
+        int getBlockWidth() const { return blockWidth; }
+        int getBlockHeight() const { return blockHeight; }
+        int blocksX() const { return (width + blockWidth - 1) / blockWidth; }
+        int blocksY() const { return (height + blockHeight - 1) / blockHeight; }
+
+    private:
+        int width = 0;
+        int height = 0;
+        int bands = 0;
+        std::string dataType;
+        int blockWidth = 1;
+        int blockHeight = 1;
+        double geoTransform[6] = { 0.0, 1.0, 0.0, 0.0, 0.0, 1.0 };
+
+        // CRC64 of the WKT, empty without SRS
+        std::string srs;
+
+        // Per band, "none" when unset
+        std::vector<std::string> nodata;
+
+        // Row-major, blocksX() * blocksY() entries
+        std::vector<std::string> blocks;
+    };
+
+}
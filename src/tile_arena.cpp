@@ -0,0 +1,51 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "tile_arena.h"
+#include "exceptions.h"
+
+namespace ddb
+{
+
+    TileArena& TileArena::local()
+    {
+        static thread_local TileArena arena;
+        return arena;
+    }
+
+    TileArena::~TileArena()
+    {
+        for (auto& d : datasets)
+            GDALClose(d.second);
+    }
+
+    uint8_t* TileArena::buffer(Slot slot, size_t size)
+    {
+        if (size > capacity[slot])
+        {
+            buffers[slot].reset(new uint8_t[size]);
+            capacity[slot] = size;
+        }
+        return buffers[slot].get();
+    }
+
+    GDALDatasetH TileArena::canvasDataset(GDALDriverH memDrv, int size, int bands, bool alpha)
+    {
+        const auto key = std::make_tuple(size, bands, alpha);
+        auto it = datasets.find(key);
+        if (it != datasets.end())
+            return it->second;
+
+        GDALDatasetH ds = GDALCreate(memDrv, "", size, size, bands, GDT_Byte, nullptr);
+        if (ds == nullptr)
+            throw GDALException("Cannot create dsTile");
+
+        if (alpha)
+            GDALSetRasterColorInterpretation(GDALGetRasterBand(ds, bands), GCI_AlphaBand);
+
+        datasets[key] = ds;
+        return ds;
+    }
+
+}
@@ -0,0 +1,53 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <tuple>
+#include "gdal_inc.h"
+
+namespace ddb {
+
+    // Scratch memory reused by the tiles rendered on the calling thread.
+    // Buffers only grow, so once a thread has seen its largest tile it
+    // renders without going through the allocator.
+    class TileArena
+    {
+    public:
+        enum Slot
+        {
+            ReadBuffer,
+            ScaledBuffer,
+            AlphaBuffer,
+            SlotCount
+        };
+
+        // Arena of the calling thread
+        static TileArena& local();
+
+        TileArena() = default;
+        ~TileArena();
+
+        TileArena(const TileArena&) = delete;
+        TileArena& operator=(const TileArena&) = delete;
+
+        // At least size bytes, valid until the next call for the same slot
+        uint8_t* buffer(Slot slot, size_t size);
+
+        // size x size Byte MEM dataset with the given number of bands, the
+        // last one flagged as alpha if alpha is set. Contents are left over
+        // from the previous tile.
+        GDALDatasetH canvasDataset(GDALDriverH memDrv, int size, int bands, bool alpha);
+
+    private:
+        std::unique_ptr<uint8_t[]> buffers[SlotCount];
+        size_t capacity[SlotCount] = {};
+
+        std::map<std::tuple<int, int, bool>, GDALDatasetH> datasets;
+    };
+
+}
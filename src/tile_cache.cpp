@@ -0,0 +1,222 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "tile_cache.h"
+#include "exceptions.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace ddb
+{
+
+    TileCache::TileCache(size_t memoryBudget, const std::string& diskPath, size_t diskBudget)
+        : memoryBudget(memoryBudget), diskPath(diskPath), diskBudget(diskBudget)
+    {
+        if (!diskEnabled())
+            return;
+
+        std::error_code ec;
+        fs::create_directories(diskPath, ec);
+        if (ec)
+            throw GDALException("Cannot create tile cache folder " + diskPath + ": " + ec.message());
+
+        // Index what a previous run left behind, least recently written first
+        std::vector<std::pair<fs::file_time_type, fs::path>> existing;
+        for (const auto& entry : fs::directory_iterator(diskPath))
+        {
+            if (!entry.is_regular_file())
+                continue;
+
+            // Leftover from an interrupted write
+            if (entry.path().extension() == ".tmp")
+                fs::remove(entry.path(), ec);
+            else
+                existing.emplace_back(entry.last_write_time(), entry.path());
+        }
+        std::sort(existing.begin(), existing.end());
+
+        for (const auto& e : existing)
+        {
+            const std::string name = e.second.filename().string();
+            const size_t size = static_cast<size_t>(fs::file_size(e.second));
+            diskLru.emplace_front(name, size);
+            diskIndex[name] = diskLru.begin();
+            counters.diskBytes += size;
+        }
+
+        while (counters.diskBytes > diskBudget && !diskLru.empty())
+        {
+            fs::remove(diskFile(diskLru.back().first), ec);
+            counters.diskBytes -= diskLru.back().second;
+            diskIndex.erase(diskLru.back().first);
+            diskLru.pop_back();
+        }
+    }
+
+    bool TileCache::get(const TileCacheKey& key, std::vector<uint8_t>& out)
+    {
+        const std::string name = keyName(key);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto it = memoryIndex.find(name);
+            if (it != memoryIndex.end())
+            {
+                memoryLru.splice(memoryLru.begin(), memoryLru, it->second);
+                out = it->second->second;
+                counters.memoryHits++;
+                return true;
+            }
+
+            auto dit = diskIndex.find(name);
+            if (dit == diskIndex.end())
+            {
+                counters.misses++;
+                return false;
+            }
+            diskLru.splice(diskLru.begin(), diskLru, dit->second);
+        }
+
+        // Read outside the lock; the file may have been evicted meanwhile
+        std::ifstream f(diskFile(name), std::ios::binary);
+        if (!f.is_open())
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            counters.misses++;
+            return false;
+        }
+        out.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.diskHits++;
+        putMemory(name, std::vector<uint8_t>(out));
+        return true;
+    }
+
+    void TileCache::put(const TileCacheKey& key, const uint8_t* data, size_t size)
+    {
+        const std::string name = keyName(key);
+
+        if (diskEnabled() && size <= diskBudget)
+            putDisk(name, data, size);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        putMemory(name, std::vector<uint8_t>(data, data + size));
+    }
+
+    void TileCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        memoryLru.clear();
+        memoryIndex.clear();
+        counters.memoryBytes = 0;
+
+        std::error_code ec;
+        for (const auto& e : diskLru)
+            fs::remove(diskFile(e.first), ec);
+        diskLru.clear();
+        diskIndex.clear();
+        counters.diskBytes = 0;
+    }
+
+    TileCacheStats TileCache::stats() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+    std::string TileCache::keyName(const TileCacheKey& key) const
+    {
+        return key.source + "_" + std::to_string(key.z) + "_" + std::to_string(key.x) + "_" +
+               std::to_string(key.y) + "_" + std::to_string(key.tileSize) + "." + key.format;
+    }
+
+    std::string TileCache::diskFile(const std::string& name) const
+    {
+        return (fs::path(diskPath) / name).string();
+    }
+
+    bool TileCache::diskEnabled() const
+    {
+        return !diskPath.empty() && diskBudget > 0;
+    }
+
+    void TileCache::putMemory(const std::string& name, std::vector<uint8_t>&& data)
+    {
+        // Caller holds the lock
+        if (data.size() > memoryBudget)
+            return;
+
+        auto it = memoryIndex.find(name);
+        if (it != memoryIndex.end())
+        {
+            counters.memoryBytes -= it->second->second.size();
+            memoryLru.erase(it->second);
+            memoryIndex.erase(it);
+        }
+
+        counters.memoryBytes += data.size();
+        memoryLru.emplace_front(name, std::move(data));
+        memoryIndex[name] = memoryLru.begin();
+
+        while (counters.memoryBytes > memoryBudget)
+        {
+            counters.memoryBytes -= memoryLru.back().second.size();
+            memoryIndex.erase(memoryLru.back().first);
+            memoryLru.pop_back();
+            counters.memoryEvictions++;
+        }
+    }
+
+    void TileCache::putDisk(const std::string& name, const uint8_t* data, size_t size)
+    {
+        // Write to a temporary name first so readers never see a partial tile
+        const std::string file = diskFile(name);
+        const std::string tmpFile = file + "." +
+            std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+        {
+            std::ofstream f(tmpFile, std::ios::binary | std::ios::trunc);
+            if (!f.is_open())
+                throw GDALException("Cannot write tile cache file " + tmpFile);
+            f.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        std::error_code ec;
+        fs::rename(tmpFile, file, ec);
+        if (ec)
+        {
+            fs::remove(tmpFile, ec);
+            return;
+        }
+
+        auto it = diskIndex.find(name);
+        if (it != diskIndex.end())
+        {
+            counters.diskBytes -= it->second->second;
+            diskLru.erase(it->second);
+            diskIndex.erase(it);
+        }
+
+        counters.diskBytes += size;
+        diskLru.emplace_front(name, size);
+        diskIndex[name] = diskLru.begin();
+
+        while (counters.diskBytes > diskBudget)
+        {
+            fs::remove(diskFile(diskLru.back().first), ec);
+            counters.diskBytes -= diskLru.back().second;
+            diskIndex.erase(diskLru.back().first);
+            diskLru.pop_back();
+            counters.diskEvictions++;
+        }
+    }
+
+}
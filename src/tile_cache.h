@@ -0,0 +1,83 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ddb {
+
+    struct TileCacheKey
+    {
+        int z;
+        int x;
+        int y;
+        int tileSize;
+        std::string format;
+
+        // Stamp of the input (path, size, modification time) and encoder
+        // settings the tile was rendered with. Part of the file names of the
+        // disk tier, so tiles it kept for another input or another encoder
+        // are never served.
+        std::string source;
+    };
+
+    struct TileCacheStats
+    {
+        uint64_t memoryHits = 0;
+        uint64_t diskHits = 0;
+        uint64_t misses = 0;
+        uint64_t memoryEvictions = 0;
+        uint64_t diskEvictions = 0;
+        size_t memoryBytes = 0;
+        size_t diskBytes = 0;
+    };
+
+    // Encoded tile cache with a byte-budgeted in-memory LRU backed by an
+    // optional size-bounded folder on disk. Writes go to both tiers, memory
+    // misses are looked up on disk and promoted. Safe to share across threads.
+    class TileCache
+    {
+    public:
+        // An empty diskPath or a zero diskBudget disables the disk tier.
+        // Tiles already in diskPath are indexed (oldest first) and reused
+        // when requested with the same key, source included.
+        TileCache(size_t memoryBudget, const std::string& diskPath = "", size_t diskBudget = 0);
+
+        bool get(const TileCacheKey& key, std::vector<uint8_t>& out);
+        void put(const TileCacheKey& key, const uint8_t* data, size_t size);
+        void clear();
+
+        TileCacheStats stats() const;
+
+    private:
+        typedef std::list<std::pair<std::string, std::vector<uint8_t>>> MemoryList;
+        typedef std::list<std::pair<std::string, size_t>> DiskList;
+
+        mutable std::mutex mutex;
+
+        size_t memoryBudget;
+        MemoryList memoryLru;
+        std::unordered_map<std::string, MemoryList::iterator> memoryIndex;
+
+        std::string diskPath;
+        size_t diskBudget;
+        DiskList diskLru;
+        std::unordered_map<std::string, DiskList::iterator> diskIndex;
+
+        TileCacheStats counters;
+
+        std::string keyName(const TileCacheKey& key) const;
+        std::string diskFile(const std::string& name) const;
+        bool diskEnabled() const;
+
+        void putMemory(const std::string& name, std::vector<uint8_t>&& data);
+        void putDisk(const std::string& name, const uint8_t* data, size_t size);
+    };
+
+}
@@ -0,0 +1,188 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "tile_metrics.h"
+#include <algorithm>
+
+namespace ddb {
+
+    const char* tileStageName(TileStage stage)
+    {
+        switch (stage)
+        {
+        case TileStage::GeoQuery:
+            return "geoQuery";
+        case TileStage::SourceRead:
+            return "sourceRead";
+        case TileStage::Rescale:
+            return "rescale";
+        case TileStage::AlphaRead:
+            return "alphaRead";
+        case TileStage::Encode:
+            return "encode";
+        case TileStage::Write:
+            return "write";
+        default:
+            return "";
+        }
+    }
+
+    int LatencyHistogram::bucketOf(uint64_t ns)
+    {
+        // Values below 2^subBits get a bucket each
+        if (ns < (uint64_t(1) << subBits))
+            return static_cast<int>(ns);
+
+        int msb = 63;
+        while ((ns >> msb) == 0)
+            msb--;
+
+        const int sub = static_cast<int>((ns >> (msb - subBits)) & ((1 << subBits) - 1));
+        return ((msb - subBits + 1) << subBits) + sub;
+    }
+
+    uint64_t LatencyHistogram::bucketMidpoint(int bucket)
+    {
+        if (bucket < (1 << subBits))
+            return static_cast<uint64_t>(bucket);
+
+        const int msb = (bucket >> subBits) + subBits - 1;
+        const uint64_t sub = static_cast<uint64_t>(bucket & ((1 << subBits) - 1));
+        const uint64_t width = uint64_t(1) << (msb - subBits);
+        const uint64_t low = (uint64_t(1) << msb) + sub * width;
+        return low + width / 2;
+    }
+
+    void LatencyHistogram::record(uint64_t ns)
+    {
+        buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        samples.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+
+        uint64_t prev = max.load(std::memory_order_relaxed);
+        while (prev < ns && !max.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void LatencyHistogram::reset()
+    {
+        for (auto& b : buckets)
+            b.store(0, std::memory_order_relaxed);
+        samples.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t LatencyHistogram::count() const
+    {
+        return samples.load(std::memory_order_relaxed);
+    }
+
+    uint64_t LatencyHistogram::totalNs() const
+    {
+        return sum.load(std::memory_order_relaxed);
+    }
+
+    uint64_t LatencyHistogram::maxNs() const
+    {
+        return max.load(std::memory_order_relaxed);
+    }
+
+    uint64_t LatencyHistogram::percentileNs(double q) const
+    {
+        // Sum the buckets rather than trusting samples, which may be ahead
+        // of them while other threads record
+        uint64_t total = 0;
+        for (const auto& b : buckets)
+            total += b.load(std::memory_order_relaxed);
+        if (total == 0)
+            return 0;
+
+        const uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(total - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < bucketCount; i++)
+        {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(bucketMidpoint(i), maxNs());
+        }
+
+        return maxNs();
+    }
+
+    void TileMetrics::setEnabled(bool enable)
+    {
+        if (enable && !enabled.load())
+            reset();
+        enabled.store(enable);
+    }
+
+    void TileMetrics::record(TileStage stage, uint64_t ns)
+    {
+        stages[static_cast<size_t>(stage)].record(ns);
+    }
+
+    void TileMetrics::addBytesRead(uint64_t bytes)
+    {
+        if (isEnabled())
+            bytesRead.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void TileMetrics::addBytesWritten(uint64_t bytes)
+    {
+        if (isEnabled())
+            bytesWritten.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void TileMetrics::addTile()
+    {
+        if (isEnabled())
+            tiles.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void TileMetrics::reset()
+    {
+        for (auto& s : stages)
+            s.reset();
+        tiles.store(0);
+        bytesRead.store(0);
+        bytesWritten.store(0);
+        startNs.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    TileMetricsReport TileMetrics::report() const
+    {
+        TileMetricsReport r;
+
+        for (size_t i = 0; i < stages.size(); i++)
+        {
+            const LatencyHistogram& h = stages[i];
+
+            TileStageReport s;
+            s.name = tileStageName(static_cast<TileStage>(i));
+            s.count = h.count();
+            if (s.count > 0)
+                s.meanMs = h.totalNs() / 1e6 / static_cast<double>(s.count);
+            s.p50Ms = h.percentileNs(0.50) / 1e6;
+            s.p99Ms = h.percentileNs(0.99) / 1e6;
+            s.maxMs = h.maxNs() / 1e6;
+            r.stages.push_back(s);
+        }
+
+        r.tiles = tiles.load();
+        r.bytesRead = bytesRead.load();
+        r.bytesWritten = bytesWritten.load();
+
+        const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        r.seconds = (now - startNs.load()) / 1e9;
+        if (r.seconds > 0.0)
+            r.tilesPerSecond = static_cast<double>(r.tiles) / r.seconds;
+
+        return r;
+    }
+
+}
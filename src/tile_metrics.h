@@ -0,0 +1,139 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ddb {
+
+    enum class TileStage
+    {
+        GeoQuery = 0,
+        SourceRead,
+        Rescale,
+        AlphaRead,
+        Encode,
+        Write,
+        Count
+    };
+
+    const char* tileStageName(TileStage stage);
+
+    // Lock-free latency histogram. Buckets split every power of two of
+    // nanoseconds in 8, so percentiles are within ~6% of the true value.
+    class LatencyHistogram
+    {
+    public:
+        void record(uint64_t ns);
+        void reset();
+
+        uint64_t count() const;
+        uint64_t totalNs() const;
+        uint64_t maxNs() const;
+
+        // Latency below which a fraction q (0-1) of the samples fall
+        uint64_t percentileNs(double q) const;
+
+    private:
+        static constexpr int subBits = 3;
+        static constexpr int bucketCount = 64 << subBits;
+
+        std::array<std::atomic<uint64_t>, bucketCount> buckets{};
+        std::atomic<uint64_t> samples{ 0 };
+        std::atomic<uint64_t> sum{ 0 };
+        std::atomic<uint64_t> max{ 0 };
+
+        static int bucketOf(uint64_t ns);
+        static uint64_t bucketMidpoint(int bucket);
+    };
+
+    struct TileStageReport
+    {
+        std::string name;
+        uint64_t count = 0;
+        double meanMs = 0.0;
+        double p50Ms = 0.0;
+        double p99Ms = 0.0;
+        double maxMs = 0.0;
+    };
+
+    struct TileMetricsReport
+    {
+        std::vector<TileStageReport> stages;
+
+        // Tiles encoded since metrics were enabled or reset
+        uint64_t tiles = 0;
+
+        // Bytes returned by source and alpha reads (before rescaling)
+        uint64_t bytesRead = 0;
+
+        // Encoded bytes handed to the sink
+        uint64_t bytesWritten = 0;
+
+        double seconds = 0.0;
+        double tilesPerSecond = 0.0;
+    };
+
+    // Per-stage latencies and throughput counters of a tiler.
+    // Disabled by default; when disabled, recording costs one relaxed load.
+    class TileMetrics
+    {
+    public:
+        void setEnabled(bool enabled);
+        bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+        void record(TileStage stage, uint64_t ns);
+        void addBytesRead(uint64_t bytes);
+        void addBytesWritten(uint64_t bytes);
+        void addTile();
+
+        void reset();
+        TileMetricsReport report() const;
+
+    private:
+        std::atomic<bool> enabled{ false };
+        std::array<LatencyHistogram, static_cast<size_t>(TileStage::Count)> stages;
+        std::atomic<uint64_t> tiles{ 0 };
+        std::atomic<uint64_t> bytesRead{ 0 };
+        std::atomic<uint64_t> bytesWritten{ 0 };
+        std::atomic<int64_t> startNs{ 0 };
+    };
+
+    // Records the lifetime of the scope into a stage histogram
+    class StageTimer
+    {
+    public:
+        StageTimer(TileMetrics& metrics, TileStage stage)
+            : metrics(metrics.isEnabled() ? &metrics : nullptr), stage(stage)
+        {
+            if (this->metrics != nullptr)
+                start = std::chrono::steady_clock::now();
+        }
+
+        ~StageTimer() { stop(); }
+
+        // Records now instead of at the end of the scope
+        void stop()
+        {
+            if (metrics != nullptr)
+                metrics->record(stage, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                           std::chrono::steady_clock::now() - start).count()));
+            metrics = nullptr;
+        }
+
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+
+    private:
+        TileMetrics* metrics;
+        TileStage stage;
+        std::chrono::steady_clock::time_point start;
+    };
+
+}
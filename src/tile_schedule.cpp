@@ -0,0 +1,76 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "tile_schedule.h"
+#include <algorithm>
+
+namespace ddb
+{
+
+    uint64_t hilbertIndex(int order, uint32_t x, uint32_t y)
+    {
+        if (order <= 0)
+            return 0;
+
+        const uint64_t n = uint64_t(1) << order;
+        uint64_t d = 0;
+        for (uint64_t s = n / 2; s > 0; s /= 2)
+        {
+            const uint32_t rx = (x & s) > 0 ? 1 : 0;
+            const uint32_t ry = (y & s) > 0 ? 1 : 0;
+            d += s * s * ((3 * rx) ^ ry);
+
+            // Rotate the quadrant so the curve stays continuous
+            if (ry == 0)
+            {
+                if (rx == 1)
+                {
+                    x = static_cast<uint32_t>(n - 1 - x);
+                    y = static_cast<uint32_t>(n - 1 - y);
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+    int hilbertOrder(uint32_t size)
+    {
+        int order = 0;
+        while (order < 31 && (uint32_t(1) << order) < size)
+            order++;
+        return order;
+    }
+
+    BlockCacheSimulator::BlockCacheSimulator(size_t capacityBlocks)
+        : capacity(std::max<size_t>(1, capacityBlocks))
+    {
+    }
+
+    bool BlockCacheSimulator::access(int level, int bx, int by)
+    {
+        const uint64_t key = (static_cast<uint64_t>(level & 0xff) << 56) |
+                             (static_cast<uint64_t>(static_cast<uint32_t>(bx) & 0xfffffff) << 28) |
+                             (static_cast<uint64_t>(static_cast<uint32_t>(by) & 0xfffffff));
+
+        auto it = index.find(key);
+        if (it != index.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            hits++;
+            return true;
+        }
+
+        misses++;
+        lru.push_front(key);
+        index[key] = lru.begin();
+        if (lru.size() > capacity)
+        {
+            index.erase(lru.back());
+            lru.pop_back();
+        }
+        return false;
+    }
+
+}
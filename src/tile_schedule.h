@@ -0,0 +1,41 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+namespace ddb {
+
+    // Position of cell x/y along a Hilbert curve covering a 2^order x 2^order grid
+    uint64_t hilbertIndex(int order, uint32_t x, uint32_t y);
+
+    // Smallest order whose grid covers size x size cells
+    int hilbertOrder(uint32_t size);
+
+    // LRU model of the GDAL block cache, used to estimate how many block
+    // reads a given tile order would serve from memory
+    class BlockCacheSimulator
+    {
+    public:
+        explicit BlockCacheSimulator(size_t capacityBlocks);
+
+        // Touches a block, returns true if it was still cached
+        bool access(int level, int bx, int by);
+
+        uint64_t accesses() const { return hits + misses; }
+        uint64_t hitCount() const { return hits; }
+
+    private:
+        size_t capacity;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+
+        std::list<uint64_t> lru;
+        std::unordered_map<uint64_t, std::list<uint64_t>::iterator> index;
+    };
+
+}
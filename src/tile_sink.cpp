@@ -0,0 +1,476 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "tile_sink.h"
+#include "exceptions.h"
+#include "hash.h"
+#include "logger.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sqlite3.h>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace ddb
+{
+
+    std::string TileSink::tilePath(int, int, int, bool) const
+    {
+        return "";
+    }
+
+    bool TileSink::isNewerThan(int, int, int, fs::file_time_type) const
+    {
+        return false;
+    }
+
+    fs::file_time_type TileSink::settingsTime(const std::string&)
+    {
+        return fs::file_time_type::max();
+    }
+
+    namespace
+    {
+        // Writes to a per-thread temporary name and renames it into place,
+        // so concurrent writers of the same file never interleave and
+        // readers see either the old or the new file
+        void writeReplace(const std::string& path, const uint8_t* data, size_t size)
+        {
+            const std::string tmpPath = path + "." +
+                std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+            {
+                std::ofstream f(tmpPath, std::ios::binary | std::ios::trunc);
+                if (!f.is_open())
+                    throw GDALException("Cannot create output file " + tmpPath);
+                f.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+                if (!f)
+                    throw GDALException("Cannot write output file " + tmpPath);
+            }
+
+            std::error_code ec;
+            fs::rename(tmpPath, path, ec);
+            if (ec)
+            {
+                fs::remove(tmpPath, ec);
+                throw GDALException("Cannot write output file " + path);
+            }
+        }
+    }
+
+    DirectoryTileSink::DirectoryTileSink(const std::string& outputPath, const std::string& extension,
+                                         bool deduplicate)
+        : outputPath(outputPath), extension(extension), deduplicate(deduplicate)
+    {
+    }
+
+    std::string DirectoryTileSink::tilePath(int z, int x, int y, bool createDirs) const
+    {
+        std::string path = outputPath + "/" + std::to_string(z) + "/" +
+                          std::to_string(x) + "/" + std::to_string(y) + "." + extension;
+
+        if (createDirs)
+        {
+            const std::string dir = path.substr(0, path.find_last_of('/'));
+            {
+                std::lock_guard<std::mutex> lock(dirsMutex);
+                if (knownDirs.find(dir) != knownDirs.end())
+                    return path;
+            }
+
+            // Another worker may create the same folder concurrently,
+            // create_directories treats an existing folder as success
+            std::error_code ec;
+            if (fs::create_directories(dir, ec)) {
+                DDB_LOG(Debug) << "Directories created: " << dir;
+            }
+            else if (ec) {
+                DDB_LOG(Error) << "Error creating directories: " << ec.message();
+                throw GDALException("Cannot create directories for tile path: " + dir);
+            }
+
+            std::lock_guard<std::mutex> lock(dirsMutex);
+            knownDirs.insert(dir);
+        }
+
+        return path;
+    }
+
+    std::string DirectoryTileSink::write(int z, int x, int y, const uint8_t* data, size_t size)
+    {
+        const std::string path = tilePath(z, x, y, true);
+
+        if (!deduplicate)
+        {
+            // Renaming replaces the directory entry, never the contents of a
+            // blob the old tile was linked to, and an interrupted seed never
+            // leaves a truncated tile behind
+            writeReplace(path, data, size);
+            return path;
+        }
+
+        const std::string blob = writeBlob(data, size);
+
+        std::error_code ec;
+        fs::remove(path, ec);
+        fs::create_hard_link(blob, path, ec);
+        if (ec)
+        {
+            // No hard links on this filesystem (or a concurrent writer won),
+            // fall back to a private copy
+            writeReplace(path, data, size);
+        }
+
+        return path;
+    }
+
+    void DirectoryTileSink::setFormat(const std::string& format)
+    {
+        extension = format;
+    }
+
+    std::string DirectoryTileSink::writeBlob(const uint8_t* data, size_t size)
+    {
+        // The size makes a CRC64 collision between different tiles even less likely
+        const std::string name = Hash::strCRC64(reinterpret_cast<const char*>(data), size) +
+                                 "_" + std::to_string(size);
+        const fs::path blobsDir = fs::path(outputPath) / ".blobs";
+        const std::string blob = (blobsDir / (name + "." + extension)).string();
+
+        // Tiles linked to a blob share its modification time, which
+        // isNewerThan reads as the time they were written: a reused blob
+        // is touched so the tiles stored through it now count as fresh
+        bool known;
+        {
+            std::lock_guard<std::mutex> lock(blobsMutex);
+            known = blobs.find(name) != blobs.end();
+        }
+
+        std::error_code ec;
+        if (known || fs::exists(blob))
+        {
+            fs::last_write_time(blob, fs::file_time_type::clock::now(), ec);
+            if (!ec)
+            {
+                if (!known)
+                {
+                    std::lock_guard<std::mutex> lock(blobsMutex);
+                    blobs.insert(name);
+                }
+                return blob;
+            }
+        }
+
+        fs::create_directories(blobsDir, ec);
+        if (ec)
+            throw GDALException("Cannot create directories for tile blobs: " + blobsDir.string());
+
+        writeReplace(blob, data, size);
+
+        std::lock_guard<std::mutex> lock(blobsMutex);
+        blobs.insert(name);
+        return blob;
+    }
+
+    bool DirectoryTileSink::read(int z, int x, int y, std::vector<uint8_t>& out)
+    {
+        std::ifstream f(tilePath(z, x, y), std::ios::binary);
+        if (!f.is_open())
+            return false;
+
+        out.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        return true;
+    }
+
+    void DirectoryTileSink::remove(int z, int x, int y)
+    {
+        // Only the link for deduplicated tiles, the blob may be shared
+        std::error_code ec;
+        fs::remove(tilePath(z, x, y), ec);
+        if (ec)
+            throw GDALException("Cannot remove tile " + tilePath(z, x, y) + ": " + ec.message());
+    }
+
+    bool DirectoryTileSink::isNewerThan(int z, int x, int y, fs::file_time_type time) const
+    {
+        std::error_code ec;
+        const fs::file_time_type written = fs::last_write_time(tilePath(z, x, y), ec);
+        return !ec && written >= time;
+    }
+
+    fs::file_time_type DirectoryTileSink::settingsTime(const std::string& settings)
+    {
+        const std::string path = (fs::path(outputPath) / ".ddb-settings").string();
+
+        std::string stored;
+        {
+            std::ifstream f(path, std::ios::binary);
+            if (f.is_open())
+                stored.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+        }
+
+        // Tiles of a folder without settings predate them and are not trusted
+        if (stored != settings)
+        {
+            std::error_code ec;
+            fs::create_directories(outputPath, ec);
+            writeReplace(path, reinterpret_cast<const uint8_t*>(settings.data()), settings.size());
+        }
+
+        std::error_code ec;
+        const fs::file_time_type adopted = fs::last_write_time(path, ec);
+        return ec ? fs::file_time_type::max() : adopted;
+    }
+
+    MBTilesTileSink::MBTilesTileSink(const std::string& path, bool tms, const std::string& format,
+                                     int batchSize, bool deduplicate)
+        : path(path), tms(tms), batchSize(std::max(1, batchSize)), deduplicate(deduplicate)
+    {
+        if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+        {
+            const std::string err = db != nullptr ? sqlite3_errmsg(db) : "out of memory";
+            sqlite3_close(db);
+            db = nullptr;
+            throw DBException("Cannot open " + path + ": " + err);
+        }
+
+        try
+        {
+            // Bulk writer: durability comes from explicit commits
+            exec("PRAGMA journal_mode=WAL");
+            exec("PRAGMA synchronous=NORMAL");
+            exec("CREATE TABLE IF NOT EXISTS metadata (name TEXT PRIMARY KEY, value TEXT)");
+
+            // An existing archive keeps its layout: tiles is a view over map/images when deduplicated
+            const std::string tilesType = objectType("tiles");
+            if (!tilesType.empty())
+                this->deduplicate = tilesType == "view";
+
+            if (this->deduplicate)
+            {
+                exec("CREATE TABLE IF NOT EXISTS map (zoom_level INTEGER, tile_column INTEGER, "
+                     "tile_row INTEGER, tile_id TEXT, PRIMARY KEY (zoom_level, tile_column, tile_row))");
+                exec("CREATE TABLE IF NOT EXISTS images (tile_id TEXT PRIMARY KEY, tile_data BLOB)");
+                exec("CREATE VIEW IF NOT EXISTS tiles AS SELECT map.zoom_level AS zoom_level, "
+                     "map.tile_column AS tile_column, map.tile_row AS tile_row, images.tile_data AS tile_data "
+                     "FROM map JOIN images ON images.tile_id = map.tile_id");
+            }
+            else
+            {
+                exec("CREATE TABLE IF NOT EXISTS tiles (zoom_level INTEGER, tile_column INTEGER, "
+                     "tile_row INTEGER, tile_data BLOB, PRIMARY KEY (zoom_level, tile_column, tile_row))");
+            }
+
+            const char* insertSql = this->deduplicate ? "INSERT OR REPLACE INTO map VALUES (?, ?, ?, ?)"
+                                                      : "INSERT OR REPLACE INTO tiles VALUES (?, ?, ?, ?)";
+            if (sqlite3_prepare_v2(db, insertSql, -1, &insertStmt, nullptr) != SQLITE_OK ||
+                (this->deduplicate &&
+                 sqlite3_prepare_v2(db, "INSERT OR IGNORE INTO images VALUES (?, ?)", -1,
+                                    &insertImageStmt, nullptr) != SQLITE_OK) ||
+                sqlite3_prepare_v2(db, "SELECT tile_data FROM tiles WHERE zoom_level = ? AND "
+                                       "tile_column = ? AND tile_row = ?", -1,
+                                   &selectStmt, nullptr) != SQLITE_OK ||
+                sqlite3_prepare_v2(db, this->deduplicate
+                                       ? "DELETE FROM map WHERE zoom_level = ? AND tile_column = ? AND tile_row = ?"
+                                       : "DELETE FROM tiles WHERE zoom_level = ? AND tile_column = ? AND tile_row = ?",
+                                   -1, &deleteStmt, nullptr) != SQLITE_OK)
+            {
+                throw DBException("Cannot prepare MBTiles statements: " + std::string(sqlite3_errmsg(db)));
+            }
+
+            setMetadata("name", fs::path(path).stem().string());
+            setMetadata("format", format);
+        }
+        catch (...)
+        {
+            sqlite3_finalize(insertStmt);
+            sqlite3_finalize(insertImageStmt);
+            sqlite3_finalize(selectStmt);
+            sqlite3_finalize(deleteStmt);
+            sqlite3_close(db);
+            throw;
+        }
+    }
+
+    MBTilesTileSink::~MBTilesTileSink()
+    {
+        try
+        {
+            flush();
+        }
+        catch (const DBException& e)
+        {
+            DDB_LOG(Error) << e.what();
+        }
+
+        sqlite3_finalize(insertStmt);
+        sqlite3_finalize(insertImageStmt);
+        sqlite3_finalize(selectStmt);
+        sqlite3_finalize(deleteStmt);
+        sqlite3_close(db);
+    }
+
+    std::string MBTilesTileSink::write(int z, int x, int y, const uint8_t* data, size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        begin();
+
+        sqlite3_bind_int(insertStmt, 1, z);
+        sqlite3_bind_int(insertStmt, 2, x);
+        sqlite3_bind_int(insertStmt, 3, tileRow(z, y));
+
+        if (deduplicate)
+        {
+            // Identical tiles share one images row
+            const std::string tileId = Hash::strCRC64(reinterpret_cast<const char*>(data), size) +
+                                       "_" + std::to_string(size);
+            sqlite3_bind_text(insertImageStmt, 1, tileId.c_str(), -1, SQLITE_TRANSIENT);
+            sqlite3_bind_blob64(insertImageStmt, 2, data, size, SQLITE_STATIC);
+            const int irc = sqlite3_step(insertImageStmt);
+            sqlite3_reset(insertImageStmt);
+            if (irc != SQLITE_DONE)
+                throw DBException("Cannot write tile image to " + path + ": " + sqlite3_errmsg(db));
+
+            sqlite3_bind_text(insertStmt, 4, tileId.c_str(), -1, SQLITE_TRANSIENT);
+        }
+        else
+        {
+            sqlite3_bind_blob64(insertStmt, 4, data, size, SQLITE_TRANSIENT);
+        }
+
+        const int rc = sqlite3_step(insertStmt);
+        sqlite3_reset(insertStmt);
+        if (rc != SQLITE_DONE)
+            throw DBException("Cannot write tile to " + path + ": " + sqlite3_errmsg(db));
+
+        if (++pending >= batchSize)
+            commit();
+
+        return path + "#" + std::to_string(z) + "/" + std::to_string(x) + "/" + std::to_string(y);
+    }
+
+    bool MBTilesTileSink::read(int z, int x, int y, std::vector<uint8_t>& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        sqlite3_bind_int(selectStmt, 1, z);
+        sqlite3_bind_int(selectStmt, 2, x);
+        sqlite3_bind_int(selectStmt, 3, tileRow(z, y));
+
+        bool found = false;
+        const int rc = sqlite3_step(selectStmt);
+        if (rc == SQLITE_ROW)
+        {
+            const auto* blob = static_cast<const uint8_t*>(sqlite3_column_blob(selectStmt, 0));
+            out.assign(blob, blob + sqlite3_column_bytes(selectStmt, 0));
+            found = true;
+        }
+        sqlite3_reset(selectStmt);
+
+        if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+            throw DBException("Cannot read tile from " + path + ": " + sqlite3_errmsg(db));
+
+        return found;
+    }
+
+    void MBTilesTileSink::remove(int z, int x, int y)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        begin();
+
+        sqlite3_bind_int(deleteStmt, 1, z);
+        sqlite3_bind_int(deleteStmt, 2, x);
+        sqlite3_bind_int(deleteStmt, 3, tileRow(z, y));
+        const int rc = sqlite3_step(deleteStmt);
+        sqlite3_reset(deleteStmt);
+        if (rc != SQLITE_DONE)
+            throw DBException("Cannot remove tile from " + path + ": " + sqlite3_errmsg(db));
+
+        if (++pending >= batchSize)
+            commit();
+    }
+
+    void MBTilesTileSink::flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        commit();
+    }
+
+    void MBTilesTileSink::setFormat(const std::string& format)
+    {
+        setMetadata("format", format);
+    }
+
+    void MBTilesTileSink::setMetadata(const std::string& name, const std::string& value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO metadata VALUES (?, ?)", -1, &stmt, nullptr) != SQLITE_OK)
+            throw DBException("Cannot prepare metadata statement: " + std::string(sqlite3_errmsg(db)));
+
+        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, value.c_str(), -1, SQLITE_TRANSIENT);
+        const int rc = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+
+        if (rc != SQLITE_DONE)
+            throw DBException("Cannot write metadata " + name + ": " + sqlite3_errmsg(db));
+    }
+
+    int MBTilesTileSink::tileRow(int z, int y) const
+    {
+        // Tiles come in flipped when the tiler runs in tms mode
+        return tms ? static_cast<int>((int64_t(1) << z) - 1 - y) : y;
+    }
+
+    std::string MBTilesTileSink::objectType(const std::string& name)
+    {
+        sqlite3_stmt* stmt = nullptr;
+        if (sqlite3_prepare_v2(db, "SELECT type FROM sqlite_master WHERE name = ?", -1, &stmt, nullptr) != SQLITE_OK)
+            throw DBException("Cannot prepare schema query: " + std::string(sqlite3_errmsg(db)));
+
+        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        std::string type;
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+            type = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        sqlite3_finalize(stmt);
+
+        return type;
+    }
+
+    void MBTilesTileSink::exec(const std::string& sql)
+    {
+        char* err = nullptr;
+        if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK)
+        {
+            const std::string msg = err != nullptr ? err : "unknown error";
+            sqlite3_free(err);
+            throw DBException("Cannot execute " + sql + ": " + msg);
+        }
+    }
+
+    void MBTilesTileSink::begin()
+    {
+        // Caller holds the lock. Asks SQLite rather than trusting pending: a
+        // write that failed after BEGIN leaves the transaction open with
+        // nothing counted, and some errors roll it back behind our back.
+        if (sqlite3_get_autocommit(db))
+            exec("BEGIN");
+    }
+
+    void MBTilesTileSink::commit()
+    {
+        // Caller holds the lock
+        pending = 0;
+        if (sqlite3_get_autocommit(db))
+            return;
+
+        exec("COMMIT");
+    }
+
+}
@@ -0,0 +1,138 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace ddb {
+
+    // Destination for encoded tiles. Coordinates are the ones passed to
+    // Tiler::tile() and Tiler::getTilePath().
+    class TileSink
+    {
+    public:
+        virtual ~TileSink() = default;
+
+        // Path of the tile file, or empty if the sink does not store
+        // tiles as individual files
+        virtual std::string tilePath(int z, int x, int y, bool createDirs = false) const;
+
+        // Stores an encoded tile and returns where it went
+        virtual std::string write(int z, int x, int y, const uint8_t* data, size_t size) = 0;
+        virtual bool read(int z, int x, int y, std::vector<uint8_t>& out) = 0;
+
+        // Deletes a stored tile, if any
+        virtual void remove(int z, int x, int y) = 0;
+
+        // True if the tile is stored and was written at or after time.
+        // Sinks that cannot tell return false, so tiles are rendered again.
+        virtual bool isNewerThan(int z, int x, int y, std::filesystem::file_time_type time) const;
+
+        // Records the settings tiles are now rendered with (tile size,
+        // encoder...) and returns when they were adopted: stored tiles older
+        // than that were rendered with other settings. Sinks that cannot
+        // tell return the maximum time.
+        virtual std::filesystem::file_time_type settingsTime(const std::string& settings);
+
+        // Makes pending writes durable
+        virtual void flush() {}
+
+        // Called by the tiler with the extension of the tiles it encodes
+        // ("png", "webp", "jpg")
+        virtual void setFormat(const std::string&) {}
+    };
+
+    // outputPath/z/x/y.ext folder tree.
+    // With deduplicate, identical tiles are stored once under
+    // outputPath/.blobs/<crc64>_<size>.ext and tile paths are hard links
+    // to that blob (or copies where hard links are not supported).
+    class DirectoryTileSink : public TileSink
+    {
+    public:
+        DirectoryTileSink(const std::string& outputPath, const std::string& extension = "png",
+                          bool deduplicate = false);
+
+        std::string tilePath(int z, int x, int y, bool createDirs = false) const override;
+        std::string write(int z, int x, int y, const uint8_t* data, size_t size) override;
+        bool read(int z, int x, int y, std::vector<uint8_t>& out) override;
+        void remove(int z, int x, int y) override;
+        bool isNewerThan(int z, int x, int y, std::filesystem::file_time_type time) const override;
+
+        // Kept in outputPath/.ddb-settings, rewritten when they change
+        std::filesystem::file_time_type settingsTime(const std::string& settings) override;
+        void setFormat(const std::string& format) override;
+
+    private:
+        std::string outputPath;
+        std::string extension;
+        bool deduplicate;
+
+        // Tile folders already created or found, so that a tile costs no
+        // extra filesystem calls once its folder is known
+        mutable std::mutex dirsMutex;
+        mutable std::unordered_set<std::string> knownDirs;
+
+        std::mutex blobsMutex;
+        std::unordered_set<std::string> blobs;
+
+        std::string writeBlob(const uint8_t* data, size_t size);
+    };
+
+    // Single-file MBTiles (SQLite) archive. Writes are batched into
+    // transactions of batchSize tiles; reads see pending writes.
+    // Pass the same tms flag as the Tiler so that tile_row is stored
+    // south-up as the MBTiles spec requires.
+    // With deduplicate, a new archive uses the map/images layout (tiles is a
+    // view) and identical tiles share one images row keyed by content hash.
+    // Existing archives keep the layout they were created with.
+    class MBTilesTileSink : public TileSink
+    {
+    public:
+        MBTilesTileSink(const std::string& path, bool tms, const std::string& format = "png",
+                        int batchSize = 1000, bool deduplicate = false);
+        ~MBTilesTileSink() override;
+
+        MBTilesTileSink(const MBTilesTileSink&) = delete;
+        MBTilesTileSink& operator=(const MBTilesTileSink&) = delete;
+
+        std::string write(int z, int x, int y, const uint8_t* data, size_t size) override;
+        bool read(int z, int x, int y, std::vector<uint8_t>& out) override;
+
+        // Deduplicated images rows are left in place
+        void remove(int z, int x, int y) override;
+        void flush() override;
+        void setFormat(const std::string& format) override;
+
+        void setMetadata(const std::string& name, const std::string& value);
+
+    private:
+        std::string path;
+        bool tms;
+        int batchSize;
+        int pending = 0;
+
+        std::mutex mutex;
+        sqlite3* db = nullptr;
+        bool deduplicate;
+        sqlite3_stmt* insertStmt = nullptr;
+        sqlite3_stmt* insertImageStmt = nullptr;
+        sqlite3_stmt* selectStmt = nullptr;
+        sqlite3_stmt* deleteStmt = nullptr;
+
+        int tileRow(int z, int y) const;
+        std::string objectType(const std::string& name);
+        void exec(const std::string& sql);
+        void begin();
+        void commit();
+    };
+
+}
@@ -0,0 +1,145 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "tile_warper.h"
+#include "exceptions.h"
+#include <algorithm>
+
+namespace ddb
+{
+
+    TileWarper::TileWarper(GDALDatasetH src, GDALDriverH memDrv, int tileSize, int bands,
+                           const TileWarpOptions& options)
+        : src(src), bands(bands), options(options)
+    {
+        const OGRSpatialReferenceH dstSrs = OSRNewSpatialReference(nullptr);
+        OSRImportFromEPSG(dstSrs, 3857);
+        char* wkt = nullptr;
+        const bool exported = OSRExportToWkt(dstSrs, &wkt) == OGRERR_NONE;
+        OSRDestroySpatialReference(dstSrs);
+        if (!exported)
+        {
+            CPLFree(wkt);
+            throw GDALException("Cannot export dst WKT. Is PROJ available?");
+        }
+        dstWkt = wkt;
+        CPLFree(wkt);
+
+        // Warp in the source type, the tiler rescales afterwards
+        const GDALDataType type = GDALGetRasterDataType(GDALGetRasterBand(src, 1));
+        dst = GDALCreate(memDrv, "", tileSize, tileSize, bands + 1, type, nullptr);
+        if (dst == nullptr)
+            throw GDALException("Cannot create warp destination");
+        GDALSetProjection(dst, dstWkt.c_str());
+        GDALSetRasterColorInterpretation(GDALGetRasterBand(dst, bands + 1), GCI_AlphaBand);
+    }
+
+    TileWarper::~TileWarper()
+    {
+        for (auto& l : levels)
+        {
+            GDALDestroyWarpOperation(l.second.operation);
+            GDALDestroyApproxTransformer(l.second.approxTransformer);
+            GDALDestroyGenImgProjTransformer(l.second.transformer);
+        }
+        GDALClose(dst);
+    }
+
+    GDALDatasetH TileWarper::warp(int zoom, const double dstGeoTransform[6], bool onWorker)
+    {
+        Level& l = level(zoom, onWorker);
+
+        double gt[6];
+        std::copy(dstGeoTransform, dstGeoTransform + 6, gt);
+        GDALSetGeoTransform(dst, gt);
+        GDALSetGenImgProjTransformerDstGeoTransform(l.transformer, gt);
+
+        if (GDALChunkAndWarpImage(l.operation, 0, 0, GDALGetRasterXSize(dst), GDALGetRasterYSize(dst)) != CE_None)
+            throw GDALException("Cannot warp tile");
+
+        return dst;
+    }
+
+    TileWarper::Level& TileWarper::level(int zoom, bool onWorker)
+    {
+        const auto key = std::make_pair(zoom, onWorker);
+        auto it = levels.find(key);
+        if (it != levels.end())
+            return it->second;
+
+        Level l;
+
+        char** targs = nullptr;
+        targs = CSLSetNameValue(targs, "DST_SRS", dstWkt.c_str());
+        l.transformer = GDALCreateGenImgProjTransformer2(src, nullptr, targs);
+        CSLDestroy(targs);
+        if (l.transformer == nullptr)
+            throw GDALException("Cannot create warp transformer");
+
+        l.approxTransformer = GDALCreateApproxTransformer(GDALGenImgProjTransform, l.transformer,
+                                                          options.errorThreshold);
+
+        GDALWarpOptions* opts = GDALCreateWarpOptions();
+        opts->hSrcDS = src;
+        opts->hDstDS = dst;
+        opts->eResampleAlg = options.resampling;
+        opts->eWorkingDataType = GDALGetRasterDataType(GDALGetRasterBand(src, 1));
+        opts->dfWarpMemoryLimit = options.memoryLimitMB * 1024.0 * 1024.0;
+
+        opts->nBandCount = bands;
+        opts->panSrcBands = static_cast<int*>(CPLMalloc(sizeof(int) * bands));
+        opts->panDstBands = static_cast<int*>(CPLMalloc(sizeof(int) * bands));
+        for (int i = 0; i < bands; i++)
+        {
+            opts->panSrcBands[i] = i + 1;
+            opts->panDstBands[i] = i + 1;
+        }
+
+        // Same transparency rules as the warped VRT: the source alpha band,
+        // or its nodata value
+        GDALRasterBandH srcAlpha = nullptr;
+        for (int n = 1; n <= GDALGetRasterCount(src); n++)
+        {
+            GDALRasterBandH b = GDALGetRasterBand(src, n);
+            if (GDALGetRasterColorInterpretation(b) == GCI_AlphaBand)
+                srcAlpha = b;
+        }
+        if (srcAlpha != nullptr)
+        {
+            opts->nSrcAlphaBand = GDALGetBandNumber(srcAlpha);
+        }
+        else
+        {
+            int hasNoData = FALSE;
+            const double noData = GDALGetRasterNoDataValue(GDALGetRasterBand(src, 1), &hasNoData);
+            if (hasNoData)
+            {
+                opts->padfSrcNoDataReal = static_cast<double*>(CPLMalloc(sizeof(double) * bands));
+                for (int i = 0; i < bands; i++)
+                    opts->padfSrcNoDataReal[i] = noData;
+            }
+        }
+        opts->nDstAlphaBand = bands + 1;
+
+        opts->papszWarpOptions = CSLSetNameValue(opts->papszWarpOptions, "INIT_DEST", "0");
+        const int threads = options.threads == 0 ? (onWorker ? 1 : -1) : options.threads;
+        opts->papszWarpOptions = CSLSetNameValue(opts->papszWarpOptions, "NUM_THREADS",
+            threads > 0 ? std::to_string(threads).c_str() : "ALL_CPUS");
+
+        opts->pfnTransformer = GDALApproxTransform;
+        opts->pTransformerArg = l.approxTransformer;
+
+        l.operation = GDALCreateWarpOperation(opts);
+        GDALDestroyWarpOptions(opts);
+        if (l.operation == nullptr)
+        {
+            GDALDestroyApproxTransformer(l.approxTransformer);
+            GDALDestroyGenImgProjTransformer(l.transformer);
+            throw GDALException("Cannot create warp operation");
+        }
+
+        return levels[key] = l;
+    }
+
+}
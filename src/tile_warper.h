@@ -0,0 +1,73 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+#include "gdal_inc.h"
+
+namespace ddb {
+
+    struct TileWarpOptions
+    {
+        // Max error (in pixels) of the approximate transformer. 0 transforms
+        // every pixel exactly.
+        double errorThreshold = 0.125;
+
+        // Memory the warper may use per chunk, in MB
+        double memoryLimitMB = 64.0;
+
+        // Warp kernel threads per tile. 0 uses all CPUs for single tile()
+        // calls but one thread per warp on the tiler's own workers
+        // (buildPyramid, renderBatch, seed, the pipeline), which already
+        // keep every CPU busy. n > 0 uses n threads and -1 all CPUs everywhere.
+        int threads = 0;
+
+        GDALResampleAlg resampling = GRA_NearestNeighbour;
+    };
+
+    // Warps tiles of a source dataset straight into a tileSize x tileSize
+    // EPSG:3857 buffer. The transformer and warp operation are built once per
+    // zoom level and only have their destination geotransform updated per tile.
+    // Like the dataset handles it wraps, an instance is used by one thread at a time.
+    class TileWarper
+    {
+    public:
+        // bands color bands of src are warped, followed by an alpha band
+        TileWarper(GDALDatasetH src, GDALDriverH memDrv, int tileSize, int bands,
+                   const TileWarpOptions& options);
+        ~TileWarper();
+
+        TileWarper(const TileWarper&) = delete;
+        TileWarper& operator=(const TileWarper&) = delete;
+
+        // Warps the tile with the given EPSG:3857 geotransform. Returns a MEM
+        // dataset with the color bands followed by alpha, owned by the warper
+        // and overwritten by the next call. onWorker tells a call made by one
+        // of several concurrent workers (see TileWarpOptions::threads).
+        GDALDatasetH warp(int zoom, const double dstGeoTransform[6], bool onWorker = false);
+
+    private:
+        struct Level
+        {
+            void* transformer = nullptr;
+            void* approxTransformer = nullptr;
+            GDALWarpOperationH operation = nullptr;
+        };
+
+        GDALDatasetH src;
+        GDALDatasetH dst = nullptr;
+        int bands;
+        TileWarpOptions options;
+        std::string dstWkt;
+
+        // Per zoom level and worker mode, the kernel thread count is fixed
+        // when the warp operation is created
+        std::map<std::pair<int, bool>, Level> levels;
+
+        Level& level(int zoom, bool onWorker);
+    };
+
+}
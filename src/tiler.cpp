@@ -3,10 +3,13 @@
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
 #include "tiler.h"
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <string>
 #include <filesystem>
 #include "exceptions.h"
+#include "logger.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -14,32 +17,96 @@
 
 namespace ddb
 {
+    namespace
+    {
+        constexpr double earthCircumference = 2 * M_PI * 6378137;
+
+        // 2^zoom for every zoom. resolution() divides initialResolution by
+        // it, the same order as the former initialResolution / (1 << zoom),
+        // and the division by a power of 2 is exact for any tile size.
+        struct ZoomScales
+        {
+            double values[GlobalMercator::maxZoom + 1];
+
+            constexpr ZoomScales() : values()
+            {
+                double s = 1.0;
+                for (int z = 0; z <= GlobalMercator::maxZoom; z++)
+                {
+                    values[z] = s;
+                    s *= 2;
+                }
+            }
+        };
+
+        constexpr ZoomScales zoomScales;
+
+        void checkZoom(int zoom)
+        {
+            if (zoom < 0 || zoom > GlobalMercator::maxZoom)
+                throw GDALException("Zoom level " + std::to_string(zoom) + " out of range 0-" +
+                                    std::to_string(GlobalMercator::maxZoom));
+        }
+
+        // Pixel coordinate to tile index, saturating outside the int range.
+        // Branch free so that the batch loops vectorize.
+        inline int pixelsToIndex(double pixels, int tileSize)
+        {
+            const double index = std::ceil(pixels / tileSize) - 1;
+            return static_cast<int>(std::min(std::max(index, double(std::numeric_limits<int>::min())),
+                                             double(std::numeric_limits<int>::max())));
+        }
+
+        inline double mercatorToLon(double mx, double originShift)
+        {
+            return (mx / originShift) * 180.0;
+        }
+
+        inline double mercatorToLat(double my, double originShift)
+        {
+            const double lat = (my / originShift) * 180.0;
+            return 180 / M_PI * (2 * atan(exp(lat * M_PI / 180.0)) - M_PI / 2.0);
+        }
+
+        // Edge of tile t in EPSG:3857 meters, rounded exactly like
+        // GlobalMercator::tileBounds: the pixel index is formed in 64-bit
+        // integers before a single multiplication by the resolution
+        inline double tileEdge(int64_t t, int tileSize, double res, double originShift)
+        {
+            return static_cast<double>(t * tileSize) * res - originShift;
+        }
+    }
+
     GlobalMercator::GlobalMercator(int tileSize) : tileSize(tileSize)
     {
         // 156543.03392804062 for tileSize 256 pixels
-        initialResolution = 2 * M_PI * 6378137 / this->tileSize;
+        initialResolution = earthCircumference / this->tileSize;
         // 20037508.342789244
         originShift = 2 * M_PI * 6378137 / 2.0;
     }
 
     BoundingBox<Projected2D> GlobalMercator::tileBounds(int tx, int ty, int zoom) const
     {
-        Projected2D min = pixelsToMeters(tx * tileSize, ty * tileSize, zoom);
-        Projected2D max = pixelsToMeters((tx + 1) * tileSize, (ty + 1) * tileSize, zoom);
+        // 64-bit: tx * tileSize overflows an int past zoom 22 with 256 px tiles
+        const int64_t x = static_cast<int64_t>(tx) * tileSize;
+        const int64_t y = static_cast<int64_t>(ty) * tileSize;
+        Projected2D min = pixelsToMeters(x, y, zoom);
+        Projected2D max = pixelsToMeters(x + tileSize, y + tileSize, zoom);
         return BoundingBox<Projected2D>(min, max);
     }
 
-    Projected2D GlobalMercator::pixelsToMeters(int px, int py, int zoom) const
+    Projected2D GlobalMercator::pixelsToMeters(int64_t px, int64_t py, int zoom) const
     {
         double res = resolution(zoom);
-        double mx = px * res - originShift;
-        double my = py * res - originShift;
+        double mx = static_cast<double>(px) * res - originShift;
+        double my = static_cast<double>(py) * res - originShift;
         return Projected2D(mx, my);
     }
 
     double GlobalMercator::resolution(int zoom) const
     {
-        return initialResolution / (1 << zoom);
+        checkZoom(zoom);
+        return initialResolution / zoomScales.values[zoom];
     }
 
     BoundingBox<Geographic2D> GlobalMercator::tileLatLonBounds(int tx, int ty, int zoom) const
@@ -52,17 +119,13 @@ namespace ddb
 
     Geographic2D GlobalMercator::metersToLatLon(double mx, double my) const
     {
-        double lon = (mx / originShift) * 180.0;
-        double lat = (my / originShift) * 180.0;
-        lat = 180 / M_PI * (2 * atan(exp(lat * M_PI / 180.0)) - M_PI / 2.0);
-        return Geographic2D(lat, lon);
+        return Geographic2D(mercatorToLat(my, originShift), mercatorToLon(mx, originShift));
     }
 
     Projected2Di GlobalMercator::metersToTile(double mx, double my, int zoom) const
     {
         Projected2D p = metersToPixels(mx, my, zoom);
-        return Projected2Di(int(ceil(p.x / double(tileSize)) - 1),
-                           int(ceil(p.y / double(tileSize)) - 1));
+        return Projected2Di(pixelsToIndex(p.x, tileSize), pixelsToIndex(p.y, tileSize));
     }
 
     Projected2D GlobalMercator::metersToPixels(double mx, double my, int zoom) const
@@ -73,30 +136,115 @@ namespace ddb
         return Projected2D(px, py);
     }
 
-    int GlobalMercator::zoomForLength(double meterLength) const
+    void GlobalMercator::tileBounds(const int* tx, const int* ty, size_t n, int zoom,
+                                    double* minX, double* minY, double* maxX, double* maxY) const
     {
-        for (int zoom = 0; zoom < 32; zoom++)
+        const double res = resolution(zoom);
+        for (size_t i = 0; i < n; i++)
         {
-            if (resolution(zoom) <= meterLength)
-                return zoom;
+            minX[i] = tileEdge(tx[i], tileSize, res, originShift);
+            minY[i] = tileEdge(ty[i], tileSize, res, originShift);
+            maxX[i] = tileEdge(int64_t(tx[i]) + 1, tileSize, res, originShift);
+            maxY[i] = tileEdge(int64_t(ty[i]) + 1, tileSize, res, originShift);
         }
-        return 31;
     }
 
-    int GlobalMercator::zoomForPixelSize(double pixelSize) const
+    void GlobalMercator::metersToTile(const double* mx, const double* my, size_t n, int zoom,
+                                      int* tx, int* ty) const
     {
-        for (int zoom = 0; zoom < 32; zoom++)
+        const double res = resolution(zoom);
+        for (size_t i = 0; i < n; i++)
+        {
+            tx[i] = pixelsToIndex((mx[i] + originShift) / res, tileSize);
+            ty[i] = pixelsToIndex((my[i] + originShift) / res, tileSize);
+        }
+    }
+
+    void GlobalMercator::tileLatLonBounds(const int* tx, const int* ty, size_t n, int zoom,
+                                          double* minLat, double* minLon, double* maxLat, double* maxLon) const
+    {
+        const double res = resolution(zoom);
+        for (size_t i = 0; i < n; i++)
+        {
+            minLon[i] = mercatorToLon(tileEdge(tx[i], tileSize, res, originShift), originShift);
+            maxLon[i] = mercatorToLon(tileEdge(int64_t(tx[i]) + 1, tileSize, res, originShift), originShift);
+        }
+
+        // atan(exp()) dominates: only evaluated when the row changes
+        for (size_t i = 0; i < n; i++)
         {
-            if (resolution(zoom) <= pixelSize)
-                return zoom;
+            if (i > 0 && ty[i] == ty[i - 1])
+            {
+                minLat[i] = minLat[i - 1];
+                maxLat[i] = maxLat[i - 1];
+                continue;
+            }
+            minLat[i] = mercatorToLat(tileEdge(ty[i], tileSize, res, originShift), originShift);
+            maxLat[i] = mercatorToLat(tileEdge(int64_t(ty[i]) + 1, tileSize, res, originShift), originShift);
         }
-        return 31;
+    }
+
+    TileGridEdges GlobalMercator::tileGridBounds(const BoundingBox<Projected2Di>& range, int zoom) const
+    {
+        TileGridEdges edges;
+        edges.minX = range.min.x;
+        edges.minY = range.min.y;
+        if (range.max.x < range.min.x || range.max.y < range.min.y)
+            return edges;
+
+        const double res = resolution(zoom);
+        edges.x.resize(static_cast<size_t>(int64_t(range.max.x) - range.min.x + 2));
+        edges.y.resize(static_cast<size_t>(int64_t(range.max.y) - range.min.y + 2));
+        for (size_t i = 0; i < edges.x.size(); i++)
+            edges.x[i] = tileEdge(range.min.x + static_cast<int64_t>(i), tileSize, res, originShift);
+        for (size_t i = 0; i < edges.y.size(); i++)
+            edges.y[i] = tileEdge(range.min.y + static_cast<int64_t>(i), tileSize, res, originShift);
+
+        return edges;
+    }
+
+    TileGridEdges GlobalMercator::tileGridLatLonBounds(const BoundingBox<Projected2Di>& range, int zoom) const
+    {
+        TileGridEdges edges = tileGridBounds(range, zoom);
+        for (double& x : edges.x)
+            x = mercatorToLon(x, originShift);
+        for (double& y : edges.y)
+            y = mercatorToLat(y, originShift);
+        return edges;
+    }
+
+    int GlobalMercator::zoomForLength(double meterLength) const
+    {
+        return zoomForPixelSize(meterLength);
+    }
+
+    int GlobalMercator::zoomForPixelSize(double pixelSize) const
+    {
+        // First zoom with initialResolution / 2^z <= pixelSize,
+        // i.e. z = ceil(log2(initialResolution / pixelSize))
+        if (!(pixelSize > 0.0))
+            return maxZoom;
+
+        const double z = std::ceil(std::log2(initialResolution / pixelSize));
+        if (z <= 0.0)
+            return 0;
+        if (z >= maxZoom)
+            return maxZoom;
+
+        // log2 may round across a power of 2 when pixelSize is (almost)
+        // exactly a zoom's resolution
+        int zoom = static_cast<int>(z);
+        if (resolution(zoom) > pixelSize)
+            zoom++;
+        else if (zoom > 0 && resolution(zoom - 1) <= pixelSize)
+            zoom--;
+        return zoom;
     }
 
     Tiler::Tiler(const std::string &inputPath, const std::string &outputPath,
                  int tileSize, bool tms)
         : inputPath(inputPath), outputPath(outputPath), tileSize(tileSize),
-          tms(tms), mercator(tileSize)
+          tms(tms), mercator(tileSize), sink(new DirectoryTileSink(outputPath))
     {
         if (!std::filesystem::exists(inputPath))
             throw std::runtime_error(inputPath + " does not exist");
@@ -113,15 +261,37 @@ namespace ddb
 
     std::string Tiler::getTilePath(int tz, int tx, int ty, bool createDirs) const
     {
-        // Simple implementation for PNG tiles
-        std::string path = outputPath + "/" + std::to_string(tz) + "/" +
-                          std::to_string(tx) + "/" + std::to_string(ty) + ".png";
-        return path;
+        return sink->tilePath(tz, tx, ty, createDirs);
+    }
+
+    void Tiler::setSink(std::unique_ptr<TileSink> sink)
+    {
+        if (!sink)
+            throw GDALException("Tile sink cannot be null");
+        this->sink = std::move(sink);
+        this->sink->setFormat(tileExtension);
+    }
+
+    void Tiler::setTileExtension(const std::string& extension)
+    {
+        tileExtension = extension;
+        sink->setFormat(extension);
+    }
+
+    TileSink& Tiler::getSink() const
+    {
+        return *sink;
+    }
+
+    bool Tiler::readTile(int tz, int tx, int ty, std::vector<uint8_t>& out) const
+    {
+        return sink->read(tz, tx, ty, out);
     }
 
     int Tiler::tmsToXYZ(int ty, int tz) const
     {
-        return (1 << tz) - 1 - ty;
+        checkZoom(tz);
+        return static_cast<int>((int64_t(1) << tz) - 1 - ty);
     }
 
     BoundingBox<Projected2Di> Tiler::getMinMaxCoordsForZ(int tz) const
@@ -129,11 +299,11 @@ namespace ddb
         BoundingBox b(mercator.metersToTile(oMinX, oMinY, tz),
             mercator.metersToTile(oMaxX, oMaxY, tz));
 
-        std::cout << "MinMaxCoordsForZ(" << tz << ") = (" << b.min.x << ", " << b.min.y << "), (" << b.max.x << ", " << b.max.y << ")" << std::endl;
+        DDB_LOG(Debug) << "MinMaxCoordsForZ(" << tz << ") = (" << b.min.x << ", " << b.min.y << "), (" << b.max.x << ", " << b.max.y << ")";
 
         // Crop tiles extending world limits (+-180,+-90)
         b.min.x = std::max<int>(0, b.min.x);
-        b.max.x = std::min<int>(static_cast<int>(std::pow(2, tz) - 1), b.max.x);
+        b.max.x = std::min<int>(static_cast<int>((int64_t(1) << tz) - 1), b.max.x);
 
         // TODO: figure this out (TMS vs. XYZ)
         //    b.min.y = std::max<double>(0, b.min.y);
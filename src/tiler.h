@@ -1,19 +1,35 @@
 #pragma once
 
 #include "geo.h"
+#include "tile_sink.h"
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace ddb {
 
+    // Tile edges of a range of tiles of one zoom: tile (x, y) spans
+    // x[x - minX] to x[x - minX + 1] and y[y - minY] to y[y - minY + 1]
+    struct TileGridEdges
+    {
+        int minX = 0;
+        int minY = 0;
+        std::vector<double> x;
+        std::vector<double> y;
+    };
+
     class GlobalMercator
     {
         int tileSize;
         double originShift;
         double initialResolution;
-        int maxZoomLevel;
 
     public:
+        // Deepest supported zoom: its tile indices still fit an int, pixel
+        // coordinates are 64-bit
+        static constexpr int maxZoom = 31;
+
         GlobalMercator(int tileSize);
 
         BoundingBox<Geographic2D> tileLatLonBounds(int tx, int ty, int zoom) const;
@@ -29,7 +45,7 @@ namespace ddb {
         Projected2Di metersToTile(double mx, double my, int zoom) const;
 
         // Converts pixel coordinates in given zoom level of pyramid to EPSG:3857"
-        Projected2D pixelsToMeters(int px, int py, int zoom) const;
+        Projected2D pixelsToMeters(int64_t px, int64_t py, int zoom) const;
 
         // Converts EPSG:3857 to pyramid pixel coordinates in given zoom level
         Projected2D metersToPixels(double mx, double my, int zoom) const;
@@ -37,7 +53,8 @@ namespace ddb {
         // Tile covering region in given pixel coordinates
         Projected2Di pixelsToTile(double px, double py) const;
 
-        // Resolution (meters/pixel) for given zoom level (measured at Equator)
+        // Resolution (meters/pixel) for given zoom level (measured at Equator).
+        // Throws for zooms outside 0-maxZoom.
         double resolution(int zoom) const;
 
         // Minimum zoom level that can fully contains a line of meterLength
@@ -45,15 +62,40 @@ namespace ddb {
 
         // Maximal scaledown zoom of the pyramid closest to the pixelSize.
         int zoomForPixelSize(double pixelSize) const;
+
+        // Batch variants over n tiles (or points) of one zoom, as parallel
+        // input and output arrays. The resolution is computed once per call;
+        // results are identical to the single tile methods for any tile size.
+        void tileBounds(const int* tx, const int* ty, size_t n, int zoom,
+                        double* minX, double* minY, double* maxX, double* maxY) const;
+        void metersToTile(const double* mx, const double* my, size_t n, int zoom, int* tx, int* ty) const;
+
+        // Consecutive tiles of the same row share their latitude conversions
+        void tileLatLonBounds(const int* tx, const int* ty, size_t n, int zoom,
+                              double* minLat, double* minLon, double* maxLat, double* maxLon) const;
+
+        // Edges of every tile in range, w + 1 and h + 1 values for w x h tiles:
+        // EPSG:3857 meters, or longitudes (x) and latitudes (y)
+        TileGridEdges tileGridBounds(const BoundingBox<Projected2Di>& range, int zoom) const;
+        TileGridEdges tileGridLatLonBounds(const BoundingBox<Projected2Di>& range, int zoom) const;
     };
 
 class  Tiler {
 public:
     Tiler(const std::string& inputPath, const std::string& outputPath, int tileSize = 256, bool tms = false);
 
+    // Path of the tile file, or empty if the sink is not file based
     std::string getTilePath(int z, int x, int y, bool createDirs = false) const;
     int tmsToXYZ(int ty, int tz) const;
 
+    // Where encoded tiles are stored, an outputPath/z/x/y.png tree by default.
+    // The sink is switched to the extension of the tiles being encoded.
+    void setSink(std::unique_ptr<TileSink> sink);
+    TileSink& getSink() const;
+
+    // Reads an already generated tile back from the sink
+    bool readTile(int z, int x, int y, std::vector<uint8_t>& out) const;
+
     BoundingBox<Projected2Di> getMinMaxCoordsForZ(int z) const;
 
     int nBands;
@@ -67,6 +109,11 @@ protected:
     int tileSize;
     bool tms;
     GlobalMercator mercator;
+    std::unique_ptr<TileSink> sink;
+
+    // Extension of the encoded tiles, follows the tile format
+    std::string tileExtension = "png";
+    void setTileExtension(const std::string& extension);
 };
 
 }
@@ -0,0 +1,113 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ddb {
+
+// Runs a fixed list of tasks over a set of worker threads.
+// Tasks are split into contiguous chunks, one per worker, so that neighbouring
+// tasks stay on the same thread. A worker takes tasks from the front of its own
+// queue and, when it runs dry, steals from the back of another worker's queue.
+template <typename T>
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(int threads) : threads(std::max(1, threads)) {}
+
+    int size() const { return threads; }
+
+    // Calls fn(workerIndex, task) for every task. Blocks until all tasks are
+    // done. If a task throws, the remaining tasks are abandoned and the first
+    // exception is rethrown here.
+    void run(const std::vector<T>& tasks, const std::function<void(int, const T&)>& fn)
+    {
+        if (tasks.empty()) return;
+
+        const int n = static_cast<int>(std::min<size_t>(threads, tasks.size()));
+        std::vector<std::unique_ptr<Queue>> queues;
+        for (int i = 0; i < n; i++) queues.emplace_back(new Queue());
+
+        const size_t chunk = (tasks.size() + n - 1) / n;
+        for (size_t i = 0; i < tasks.size(); i++)
+            queues[i / chunk]->tasks.push_back(tasks[i]);
+
+        std::atomic<bool> abort(false);
+        std::exception_ptr error;
+        std::mutex errorMutex;
+
+        auto worker = [&](int id) {
+            T task;
+            while (!abort && next(queues, id, task))
+            {
+                try
+                {
+                    fn(id, task);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) error = std::current_exception();
+                    abort = true;
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (int i = 1; i < n; i++) pool.emplace_back(worker, i);
+        worker(0);
+        for (auto& t : pool) t.join();
+
+        if (error) std::rethrow_exception(error);
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<T> tasks;
+    };
+
+    int threads;
+
+    bool next(std::vector<std::unique_ptr<Queue>>& queues, int id, T& task)
+    {
+        {
+            Queue& own = *queues[id];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+
+        // No new tasks are ever added, so a full pass over
+        // empty queues means there is nothing left to do
+        const int n = static_cast<int>(queues.size());
+        for (int i = 1; i < n; i++)
+        {
+            Queue& victim = *queues[(id + i) % n];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+}
@@ -0,0 +1,193 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+// Seeds tiles of a raster, resuming an interrupted run from its checkpoint:
+//
+//   testseed input.tif out_dir|out.mbtiles [--bbox minLon,minLat,maxLon,maxLat]
+//            [--zoom min-max] [--format png|webp|jpg] [--tile-size 256] [--tms]
+//            [--threads n] [--checkpoint file] [--checkpoint-seconds 30] [--force]
+//
+// Without --bbox the whole raster is seeded, without --zoom its native zoom
+// range. The checkpoint defaults to <output>.seed; --force discards it and
+// renders tiles that are already stored.
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "exceptions.h"
+#include "gdal_inc.h"
+#include "gdaltiler.h"
+#include "tile_sink.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct SeedArgs {
+    std::string input;
+    std::string output;
+    bool hasBBox = false;
+    double bbox[4] = { 0.0, 0.0, 0.0, 0.0 };
+    int minZ = -1;
+    int maxZ = -1;
+    ddb::TileFormat format = ddb::TileFormat::PNG;
+    int tileSize = 256;
+    bool tms = false;
+    int threads = 0;
+    std::string checkpoint;
+    double checkpointSeconds = 30.0;
+    bool force = false;
+};
+
+void usage(const char* exe) {
+    std::cerr << "Usage: " << exe << " input.tif out_dir|out.mbtiles [--bbox minLon,minLat,maxLon,maxLat]"
+              << " [--zoom min-max] [--format png|webp|jpg] [--tile-size 256] [--tms] [--threads 0]"
+              << " [--checkpoint file] [--checkpoint-seconds 30] [--force]" << std::endl;
+}
+
+ddb::TileFormat parseFormat(const std::string& name) {
+    if (name == "png")
+        return ddb::TileFormat::PNG;
+    if (name == "webp")
+        return ddb::TileFormat::WEBP;
+    if (name == "jpg" || name == "jpeg")
+        return ddb::TileFormat::JPEG;
+    throw std::invalid_argument("Unknown format " + name);
+}
+
+SeedArgs parseArgs(int argc, char** argv) {
+    SeedArgs args;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc)
+                throw std::invalid_argument("Missing value for " + arg);
+            return argv[++i];
+        };
+
+        if (arg == "--bbox") {
+            std::istringstream v(value());
+            char sep = 0;
+            if (!(v >> args.bbox[0] >> sep >> args.bbox[1] >> sep >> args.bbox[2] >> sep >> args.bbox[3]))
+                throw std::invalid_argument("Invalid bbox, expected minLon,minLat,maxLon,maxLat");
+            args.hasBBox = true;
+        } else if (arg == "--zoom") {
+            const std::string v = value();
+            const size_t sep = v.find('-');
+            args.minZ = std::stoi(v.substr(0, sep));
+            args.maxZ = sep == std::string::npos ? args.minZ : std::stoi(v.substr(sep + 1));
+        } else if (arg == "--format") {
+            args.format = parseFormat(value());
+        } else if (arg == "--tile-size") {
+            args.tileSize = std::stoi(value());
+        } else if (arg == "--tms") {
+            args.tms = true;
+        } else if (arg == "--threads") {
+            args.threads = std::stoi(value());
+        } else if (arg == "--checkpoint") {
+            args.checkpoint = value();
+        } else if (arg == "--checkpoint-seconds") {
+            args.checkpointSeconds = std::stod(value());
+        } else if (arg == "--force") {
+            args.force = true;
+        } else if (arg.rfind("--", 0) != 0 && args.input.empty()) {
+            args.input = arg;
+        } else if (arg.rfind("--", 0) != 0 && args.output.empty()) {
+            args.output = arg;
+        } else {
+            throw std::invalid_argument("Unknown argument " + arg);
+        }
+    }
+
+    if (args.input.empty() || args.output.empty())
+        throw std::invalid_argument("Missing input or output path");
+    if (args.checkpoint.empty())
+        args.checkpoint = args.output + ".seed";
+    return args;
+}
+
+// WGS84 lon/lat bounds to EPSG:3857
+ddb::BoundingBox<ddb::Projected2D> toMercator(const double bbox[4]) {
+    const OGRSpatialReferenceH wgs84 = OSRNewSpatialReference(nullptr);
+    const OGRSpatialReferenceH mercator = OSRNewSpatialReference(nullptr);
+    OSRImportFromEPSG(wgs84, 4326);
+    OSRImportFromEPSG(mercator, 3857);
+    OSRSetAxisMappingStrategy(wgs84, OAMS_TRADITIONAL_GIS_ORDER);
+    OSRSetAxisMappingStrategy(mercator, OAMS_TRADITIONAL_GIS_ORDER);
+    const OGRCoordinateTransformationH ct = OCTNewCoordinateTransformation(wgs84, mercator);
+    OSRDestroySpatialReference(wgs84);
+    OSRDestroySpatialReference(mercator);
+    if (ct == nullptr)
+        throw ddb::GDALException("Cannot create WGS84 to EPSG:3857 transformation");
+
+    // Web Mercator is undefined at the poles
+    double minX = 0.0, minY = 0.0, maxX = 0.0, maxY = 0.0;
+    const bool ok = OCTTransformBounds(ct, bbox[0], std::max(bbox[1], -85.0511287798),
+                                       bbox[2], std::min(bbox[3], 85.0511287798),
+                                       &minX, &minY, &maxX, &maxY, 21) != 0;
+    OCTDestroyCoordinateTransformation(ct);
+    if (!ok)
+        throw ddb::GDALException("Cannot transform bbox to EPSG:3857");
+
+    return ddb::BoundingBox<ddb::Projected2D>(ddb::Projected2D(minX, minY), ddb::Projected2D(maxX, maxY));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    SeedArgs args;
+    try {
+        args = parseArgs(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        usage(argv[0]);
+        return 1;
+    }
+
+    GDALAllRegister();
+
+    try {
+        ddb::GDALTiler tiler(args.input, args.output, args.tileSize, args.tms);
+        if (fs::path(args.output).extension() == ".mbtiles")
+            tiler.setSink(std::make_unique<ddb::MBTilesTileSink>(args.output, args.tms));
+
+        if (args.force) {
+            std::error_code ec;
+            fs::remove(args.checkpoint, ec);
+            tiler.setForceRender(true);
+        }
+
+        ddb::SeedOptions options;
+        options.bbox = args.hasBBox
+            ? toMercator(args.bbox)
+            : ddb::BoundingBox<ddb::Projected2D>(ddb::Projected2D(tiler.oMinX, tiler.oMinY),
+                                                 ddb::Projected2D(tiler.oMaxX, tiler.oMaxY));
+        options.minZ = args.minZ >= 0 ? args.minZ : tiler.tMinZ;
+        options.maxZ = args.maxZ >= 0 ? args.maxZ : tiler.tMaxZ;
+        options.format = args.format;
+        options.checkpointPath = args.checkpoint;
+        options.checkpointSeconds = args.checkpointSeconds;
+        options.threads = args.threads;
+
+        std::cout << "Seeding " << args.input << " zoom " << options.minZ << "-" << options.maxZ
+                  << " to " << args.output << std::endl;
+
+        const ddb::SeedStats stats = tiler.seed(options);
+
+        std::cout << stats.total << " tiles, " << stats.alreadyDone << " done by a previous run, "
+                  << stats.rendered << " processed (" << stats.written << " written, "
+                  << stats.skipped << " up to date) in " << stats.seconds << "s, "
+                  << stats.checkpoints << " checkpoints" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Seed failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}